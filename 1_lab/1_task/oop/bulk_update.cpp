@@ -0,0 +1,272 @@
+#include <mongocxx/client.hpp>
+#include <mongocxx/instance.hpp>
+#include <mongocxx/uri.hpp>
+#include <mongocxx/pool.hpp>
+#include <mongocxx/collection.hpp>
+#include <mongocxx/bulk_write.hpp>
+#include <mongocxx/options/bulk_write.hpp>
+#include <mongocxx/model/update_one.hpp>
+#include <mongocxx/exception/bulk_write_exception.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/types.hpp>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+// Новый средний балл для студента (ключ студента - ФИО)
+struct GradeUpdate {
+    std::string surname;
+    std::string name;
+    std::string patronymic;
+    double grade;
+};
+
+// Массовое обновление средних баллов через bulk_write
+class BulkGradeUpdater {
+private:
+    mongocxx::instance instance;
+    mongocxx::pool pool;
+    std::string db_name;
+    std::string coll_name;
+    size_t batch_size;
+    int workers;
+    int max_retries;
+
+    // Очередь пачек между читателем и рабочими потоками
+    std::deque<std::vector<GradeUpdate>> queue;
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    bool input_done = false;
+
+    std::atomic<long long> applied{0};
+    std::atomic<long long> matched{0};
+    std::atomic<long long> modified{0};
+    std::atomic<long long> retried{0};
+    std::atomic<long long> failed{0};
+
+    // Выполняем одну неупорядоченную пачку, возвращаем индексы упавших документов
+    std::vector<size_t> execute_batch(mongocxx::collection& collection,
+                                      const std::vector<GradeUpdate>& batch) {
+        mongocxx::options::bulk_write opts;
+        opts.ordered(false);
+        auto bulk = collection.create_bulk_write(opts);
+
+        for (const auto& update : batch) {
+            bulk.append(mongocxx::model::update_one{
+                bsoncxx::builder::basic::make_document(
+                    bsoncxx::builder::basic::kvp("Фамилия", update.surname),
+                    bsoncxx::builder::basic::kvp("Имя", update.name),
+                    bsoncxx::builder::basic::kvp("Отчество", update.patronymic)
+                ),
+                bsoncxx::builder::basic::make_document(
+                    bsoncxx::builder::basic::kvp("$set", bsoncxx::builder::basic::make_document(
+                        bsoncxx::builder::basic::kvp("Средний_балл", update.grade)
+                    ))
+                )
+            });
+        }
+
+        std::vector<size_t> failed_indexes;
+        try {
+            auto result = bulk.execute();
+            if (result) {
+                matched += result->matched_count();
+                modified += result->modified_count();
+            }
+        } catch (const mongocxx::bulk_write_exception& e) {
+            // Неупорядоченная пачка: всё, кроме writeErrors, уже применено
+            const auto& raw = e.raw_server_error();
+            if (raw && raw->view()["writeErrors"]) {
+                for (auto& error : raw->view()["writeErrors"].get_array().value) {
+                    auto index = error.get_document().view()["index"];
+                    if (index) {
+                        failed_indexes.push_back(static_cast<size_t>(index.get_int32().value));
+                    }
+                }
+                if (raw->view()["nMatched"]) {
+                    matched += raw->view()["nMatched"].get_int32().value;
+                }
+                if (raw->view()["nModified"]) {
+                    modified += raw->view()["nModified"].get_int32().value;
+                }
+            } else {
+                // Ошибка без деталей по документам: повторяем всю пачку
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    failed_indexes.push_back(i);
+                }
+            }
+        }
+        return failed_indexes;
+    }
+
+    // Пачка с повторами только упавших документов
+    void apply_batch(mongocxx::collection& collection, std::vector<GradeUpdate> batch) {
+        size_t total = batch.size();
+        for (int attempt = 0; !batch.empty(); ++attempt) {
+            std::vector<size_t> failed_indexes = execute_batch(collection, batch);
+            if (failed_indexes.empty()) {
+                break;
+            }
+            if (attempt == max_retries) {
+                failed += failed_indexes.size();
+                total -= failed_indexes.size();
+                break;
+            }
+
+            std::vector<GradeUpdate> retry;
+            retry.reserve(failed_indexes.size());
+            for (size_t index : failed_indexes) {
+                retry.push_back(batch[index]);
+            }
+            retried += retry.size();
+            batch = std::move(retry);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50 << attempt));
+        }
+        applied += total;
+    }
+
+    void worker() {
+        // Каждый поток берёт своё соединение из пула
+        auto client = pool.acquire();
+        auto collection = (*client)[db_name][coll_name];
+
+        while (true) {
+            std::vector<GradeUpdate> batch;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue_cv.wait(lock, [this] { return !queue.empty() || input_done; });
+                if (queue.empty()) {
+                    return;
+                }
+                batch = std::move(queue.front());
+                queue.pop_front();
+            }
+            queue_cv.notify_all();
+            apply_batch(collection, std::move(batch));
+        }
+    }
+
+    void push_batch(std::vector<GradeUpdate>&& batch) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        // Ограничиваем очередь, чтобы чтение не обгоняло запись
+        queue_cv.wait(lock, [this] { return queue.size() < static_cast<size_t>(workers) * 2; });
+        queue.push_back(std::move(batch));
+        lock.unlock();
+        queue_cv.notify_all();
+    }
+
+public:
+    BulkGradeUpdater(const std::string& uri,
+                     const std::string& db_name,
+                     const std::string& coll_name,
+                     size_t batch_size = 1000,
+                     int workers = 4,
+                     int max_retries = 3)
+        : pool{mongocxx::uri{uri}},
+          db_name(db_name),
+          coll_name(coll_name),
+          batch_size(batch_size),
+          workers(workers),
+          max_retries(max_retries) {}
+
+    // Читаем строки "Фамилия Имя Отчество Балл" и применяем их пачками
+    void run(std::istream& input) {
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < workers; ++i) {
+            threads.emplace_back(&BulkGradeUpdater::worker, this);
+        }
+
+        long long read = 0;
+        long long skipped = 0;
+        std::vector<GradeUpdate> batch;
+        batch.reserve(batch_size);
+        std::string line;
+        while (std::getline(input, line)) {
+            std::istringstream fields(line);
+            GradeUpdate update;
+            if (!(fields >> update.surname >> update.name >> update.patronymic >> update.grade)) {
+                if (!line.empty()) {
+                    ++skipped;
+                }
+                continue;
+            }
+            ++read;
+            batch.push_back(std::move(update));
+            if (batch.size() == batch_size) {
+                push_batch(std::move(batch));
+                batch = std::vector<GradeUpdate>{};
+                batch.reserve(batch_size);
+            }
+        }
+        if (!batch.empty()) {
+            push_batch(std::move(batch));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            input_done = true;
+        }
+        queue_cv.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Прочитано записей: " << read;
+        if (skipped > 0) {
+            std::cout << " (пропущено некорректных строк: " << skipped << ")";
+        }
+        std::cout << std::endl;
+        std::cout << "Применено: " << applied
+                  << ", найдено: " << matched
+                  << ", изменено: " << modified
+                  << ", повторов: " << retried
+                  << ", ошибок: " << failed << std::endl;
+        std::cout << "Время: " << std::fixed << std::setprecision(3) << seconds << " с, "
+                  << "скорость: " << std::setprecision(0) << (seconds > 0 ? applied / seconds : 0.0)
+                  << " документов/с"
+                  << std::defaultfloat << std::endl;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    try {
+        // Использование: oop_bulk_update [файл] [размер_пачки] [потоков]
+        long long batch_size = argc > 2 ? std::stoll(argv[2]) : 1000;
+        int workers = argc > 3 ? std::stoi(argv[3]) : 4;
+        if (batch_size <= 0 || workers <= 0) {
+            // При 0 потоков очередь никогда не разгрузится, при пачке 0 весь ввод уйдёт одной пачкой
+            std::cerr << "Использование: oop_bulk_update [файл] [размер_пачки] [потоков]" << std::endl;
+            std::cerr << "Нужно размер_пачки > 0 и потоков > 0" << std::endl;
+            return 1;
+        }
+
+        BulkGradeUpdater updater("mongodb://localhost:27017/?maxPoolSize=" + std::to_string(workers),
+                                 "university", "students", static_cast<size_t>(batch_size), workers);
+
+        if (argc > 1 && std::string(argv[1]) != "-") {
+            std::ifstream file(argv[1]);
+            if (!file) {
+                std::cerr << "Не удалось открыть файл: " << argv[1] << std::endl;
+                return 1;
+            }
+            updater.run(file);
+        } else {
+            updater.run(std::cin);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Ошибка: " << e.what() << std::endl;
+        return 1;
+    }
+}
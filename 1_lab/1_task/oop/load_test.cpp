@@ -0,0 +1,380 @@
+#include <mongocxx/client.hpp>
+#include <mongocxx/instance.hpp>
+#include <mongocxx/uri.hpp>
+#include <mongocxx/pool.hpp>
+#include <mongocxx/collection.hpp>
+#include <mongocxx/options/find.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+// Запросы из первого таска, которыми нагружаем сервер
+enum class QueryShape {
+    Average,   // средний балл, возраст < 19
+    Max,       // максимальный балл, возраст < 19
+    Top,       // топ-3 по баллу, возраст < 19
+    Regex,     // средний балл, фамилия на "А"
+    Compound   // максимальный балл, балл < 70 и возраст < 19
+};
+
+const std::array<const char*, 5> shape_names = {"avg", "max", "top", "regex", "compound"};
+
+// Гистограмма задержек: 4 корзины на каждое удвоение, от 1 мкс до ~70 с
+class LatencyHistogram {
+private:
+    static const int per_octave = 4;
+    static const int bucket_count = 26 * per_octave;
+    std::array<uint64_t, bucket_count> buckets{};
+    uint64_t total = 0;
+    double max_us = 0.0;
+
+    static int bucket(double us) {
+        if (us <= 1.0) {
+            return 0;
+        }
+        int index = static_cast<int>(std::log2(us) * per_octave);
+        return std::min(index, bucket_count - 1);
+    }
+
+    // Верхняя граница корзины в микросекундах
+    static double upper(int index) {
+        return std::exp2(static_cast<double>(index + 1) / per_octave);
+    }
+
+public:
+    void record(double us) {
+        ++buckets[bucket(us)];
+        ++total;
+        max_us = std::max(max_us, us);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < bucket_count; ++i) {
+            buckets[i] += other.buckets[i];
+        }
+        total += other.total;
+        max_us = std::max(max_us, other.max_us);
+    }
+
+    uint64_t count() const {
+        return total;
+    }
+
+    // Перцентиль как верхняя граница корзины (погрешность не больше 19%)
+    double percentile_ms(double p) const {
+        if (total == 0) {
+            return 0.0;
+        }
+        uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100.0 * total));
+        uint64_t seen = 0;
+        for (int i = 0; i < bucket_count; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return std::min(upper(i), max_us) / 1000.0;
+            }
+        }
+        return max_us / 1000.0;
+    }
+
+    double max_ms() const {
+        return max_us / 1000.0;
+    }
+
+    void print(std::ostream& out) const {
+        for (int i = 0; i < bucket_count; ++i) {
+            if (buckets[i] == 0) {
+                continue;
+            }
+            out << "      <= " << std::setw(10) << upper(i) / 1000.0 << " мс: " << buckets[i] << std::endl;
+        }
+    }
+};
+
+// Статистика одного клиента; сливается после остановки, поэтому без атомиков
+struct ClientStats {
+    std::array<LatencyHistogram, 5> latency;
+    std::array<uint64_t, 5> errors{};
+    uint64_t late = 0;  // запросов, отправленных позже расписания
+};
+
+class LoadTest {
+private:
+    mongocxx::instance instance;
+    std::string uri;
+    std::string db_name;
+    std::string coll_name;
+    int clients;
+    double rate;  // запросов в секунду на всех клиентов
+    std::chrono::milliseconds duration;
+    std::vector<double> weights;  // доля каждого запроса в смеси
+
+    static bsoncxx::document::value young() {
+        return bsoncxx::builder::basic::make_document(
+            bsoncxx::builder::basic::kvp("Возраст", bsoncxx::builder::basic::make_document(
+                bsoncxx::builder::basic::kvp("$lt", 19)
+            ))
+        );
+    }
+
+    // Как отчёты первого таска: отфильтрованные студенты с той же проекцией
+    // выкачиваются целиком, агрегат считается уже на клиенте
+    static void run_report(mongocxx::collection& collection, bsoncxx::document::view filter) {
+        static const auto projection = bsoncxx::builder::basic::make_document(
+            bsoncxx::builder::basic::kvp("_id", 0),
+            bsoncxx::builder::basic::kvp("Фамилия", 1),
+            bsoncxx::builder::basic::kvp("Имя", 1),
+            bsoncxx::builder::basic::kvp("Отчество", 1),
+            bsoncxx::builder::basic::kvp("Возраст", 1),
+            bsoncxx::builder::basic::kvp("Группа", 1),
+            bsoncxx::builder::basic::kvp("Средний_балл", 1)
+        );
+        mongocxx::options::find opts;
+        opts.projection(projection.view());
+        for (auto&& doc : collection.find(filter, opts)) {
+            (void)doc;
+        }
+    }
+
+    static void run_query(mongocxx::collection& collection, QueryShape shape) {
+        switch (shape) {
+            case QueryShape::Average:
+                run_report(collection, young().view());
+                break;
+            case QueryShape::Max:
+                run_report(collection, young().view());
+                break;
+            case QueryShape::Top: {
+                mongocxx::options::find opts;
+                opts.sort(bsoncxx::builder::basic::make_document(bsoncxx::builder::basic::kvp("Средний_балл", -1)));
+                opts.limit(3);
+                for (auto&& doc : collection.find(young().view(), opts)) {
+                    (void)doc;
+                }
+                break;
+            }
+            case QueryShape::Regex:
+                run_report(collection, bsoncxx::builder::basic::make_document(
+                    bsoncxx::builder::basic::kvp("Фамилия", bsoncxx::builder::basic::make_document(
+                        bsoncxx::builder::basic::kvp("$regex", "^А")
+                    ))
+                ).view());
+                break;
+            case QueryShape::Compound:
+                run_report(collection, bsoncxx::builder::basic::make_document(
+                    bsoncxx::builder::basic::kvp("Средний_балл", bsoncxx::builder::basic::make_document(
+                        bsoncxx::builder::basic::kvp("$lt", 70)
+                    )),
+                    bsoncxx::builder::basic::kvp("Возраст", bsoncxx::builder::basic::make_document(
+                        bsoncxx::builder::basic::kvp("$lt", 19)
+                    ))
+                ).view());
+                break;
+        }
+    }
+
+    // Клиент шлёт запросы по расписанию (открытая модель): задержка считается от
+    // запланированного момента, поэтому очередь при перегрузке попадает в задержку
+    void client(mongocxx::pool& pool, int id, std::chrono::steady_clock::time_point start, ClientStats& stats) {
+        std::mt19937 gen(static_cast<uint32_t>(id) * 7919u + 1);
+        std::discrete_distribution<int> pick(weights.begin(), weights.end());
+        auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(clients / rate));
+        // Клиенты сдвинуты друг относительно друга, чтобы не стартовать залпом
+        auto scheduled = start + interval * id / clients;
+        auto stop = start + duration;
+
+        while (scheduled < stop) {
+            auto now = std::chrono::steady_clock::now();
+            if (now < scheduled) {
+                std::this_thread::sleep_until(scheduled);
+            } else if (now - scheduled > std::chrono::milliseconds(1)) {
+                ++stats.late;
+            }
+
+            int shape = pick(gen);
+            try {
+                auto entry = pool.acquire();
+                auto collection = (*entry)[db_name][coll_name];
+                run_query(collection, static_cast<QueryShape>(shape));
+            } catch (const std::exception&) {
+                ++stats.errors[shape];
+            }
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - scheduled).count();
+            stats.latency[shape].record(us);
+            scheduled += interval;
+        }
+    }
+
+    // URI с maxPoolSize. mongocxx::uri неизменяем, а options::pool размер пула не задаёт,
+    // поэтому исходный URI сначала разбирает драйвер, а опция встаёт в начало строки
+    // запроса: путь и уже заданные опции сохраняются, свой maxPoolSize в --uri запрещён
+    mongocxx::uri pool_uri(int pool_size) const {
+        mongocxx::uri base{uri};
+        if (base.options()["maxpoolsize"]) {
+            throw std::runtime_error("maxPoolSize задаётся через --pools, а не в --uri");
+        }
+        std::string option = "maxPoolSize=" + std::to_string(pool_size);
+        std::string text = uri;
+        size_t query = text.find('?');
+        if (query != std::string::npos) {
+            text.insert(query + 1, query + 1 == text.size() ? option : option + "&");
+        } else if (text.find('/', text.find("://") + 3) != std::string::npos) {
+            text += "?" + option;
+        } else {
+            text += "/?" + option;
+        }
+        return mongocxx::uri{text};
+    }
+
+public:
+    LoadTest(std::string uri,
+             std::string db_name,
+             std::string coll_name,
+             int clients,
+             double rate,
+             std::chrono::milliseconds duration,
+             std::vector<double> weights)
+        : uri(std::move(uri)),
+          db_name(std::move(db_name)),
+          coll_name(std::move(coll_name)),
+          clients(clients),
+          rate(rate),
+          duration(duration),
+          weights(std::move(weights)) {}
+
+    // Один прогон с пулом на pool_size соединений
+    void run(int pool_size, bool histogram) {
+        mongocxx::pool pool{pool_uri(pool_size)};
+
+        std::vector<ClientStats> stats(clients);
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < clients; ++i) {
+            threads.emplace_back(&LoadTest::client, this, std::ref(pool), i, start, std::ref(stats[i]));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        ClientStats total;
+        for (const auto& client_stats : stats) {
+            for (size_t shape = 0; shape < shape_names.size(); ++shape) {
+                total.latency[shape].merge(client_stats.latency[shape]);
+                total.errors[shape] += client_stats.errors[shape];
+            }
+            total.late += client_stats.late;
+        }
+
+        uint64_t requests = 0;
+        uint64_t errors = 0;
+        for (size_t shape = 0; shape < shape_names.size(); ++shape) {
+            requests += total.latency[shape].count();
+            errors += total.errors[shape];
+        }
+        std::cout << "Пул " << pool_size << ": запросов " << requests
+                  << " за " << std::fixed << std::setprecision(2) << seconds << " с, "
+                  << "пропускная способность " << std::setprecision(1) << requests / seconds << "/с"
+                  << " (цель " << rate << "/с), ошибок " << errors
+                  << ", с опозданием " << total.late
+                  << std::endl;
+        for (size_t shape = 0; shape < shape_names.size(); ++shape) {
+            const auto& latency = total.latency[shape];
+            if (latency.count() == 0) {
+                continue;
+            }
+            std::cout << "  " << std::left << std::setw(9) << shape_names[shape] << std::right
+                      << " n=" << latency.count()
+                      << std::setprecision(2)
+                      << " p50=" << latency.percentile_ms(50)
+                      << " p90=" << latency.percentile_ms(90)
+                      << " p99=" << latency.percentile_ms(99)
+                      << " max=" << latency.max_ms() << " мс"
+                      << std::endl;
+            if (histogram) {
+                latency.print(std::cout);
+            }
+        }
+        std::cout << std::defaultfloat;
+    }
+};
+
+// "1,2,4" -> {1, 2, 4}
+std::vector<double> parse_list(const std::string& text) {
+    std::vector<double> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        values.push_back(std::stod(item));
+    }
+    return values;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        // Использование: oop_load_test [--clients N] [--rate R] [--duration S] [--pools 1,2,4,8]
+        //                                [--mix avg,max,top,regex,compound] [--uri URI] [--histogram]
+        // --mix задаёт веса запросов, например 3,1,1,2,1; --rate - запросов в секунду на всех клиентов
+        int clients = 8;
+        double rate = 200;
+        double seconds = 10;
+        std::vector<double> pools = {1, 2, 4, 8, 16};
+        std::vector<double> mix = {3, 1, 1, 2, 1};
+        std::string uri = "mongodb://localhost:27017";
+        bool histogram = false;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--clients" && i + 1 < argc) {
+                clients = std::stoi(argv[++i]);
+            } else if (arg == "--rate" && i + 1 < argc) {
+                rate = std::stod(argv[++i]);
+            } else if (arg == "--duration" && i + 1 < argc) {
+                seconds = std::stod(argv[++i]);
+            } else if (arg == "--pools" && i + 1 < argc) {
+                pools = parse_list(argv[++i]);
+            } else if (arg == "--mix" && i + 1 < argc) {
+                mix = parse_list(argv[++i]);
+            } else if (arg == "--uri" && i + 1 < argc) {
+                uri = argv[++i];
+            } else if (arg == "--histogram") {
+                histogram = true;
+            } else {
+                std::cerr << "Неизвестный аргумент: " << arg << std::endl;
+                return 1;
+            }
+        }
+        if (clients <= 0 || rate <= 0 || seconds <= 0 || mix.size() != shape_names.size()) {
+            std::cerr << "Нужно clients > 0, rate > 0, duration > 0 и " << shape_names.size()
+                      << " весов в --mix" << std::endl;
+            return 1;
+        }
+        for (double pool_size : pools) {
+            if (pool_size <= 0 || pool_size > std::numeric_limits<int>::max() || pool_size != std::floor(pool_size)) {
+                std::cerr << "Размеры пулов в --pools должны быть целыми > 0: " << pool_size << std::endl;
+                return 1;
+            }
+        }
+
+        LoadTest test(uri, "university", "students", clients, rate,
+                      std::chrono::milliseconds(static_cast<long long>(seconds * 1000)), mix);
+        std::cout << "Клиентов: " << clients << ", цель: " << rate << " запросов/с, "
+                  << "длительность: " << seconds << " с" << std::endl;
+        for (double pool_size : pools) {
+            test.run(static_cast<int>(pool_size), histogram);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Ошибка: " << e.what() << std::endl;
+        return 1;
+    }
+}
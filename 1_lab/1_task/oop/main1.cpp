@@ -2,29 +2,1948 @@
 #include <mongocxx/instance.hpp>
 #include <mongocxx/uri.hpp>
 #include <mongocxx/collection.hpp>
+#include <mongocxx/options/find.hpp>
+#include <mongocxx/pipeline.hpp>
+#include <mongocxx/options/aggregate.hpp>
+#include <mongocxx/exception/operation_exception.hpp>
 #include <bsoncxx/json.hpp>
 #include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/types.hpp>
 #include <bsoncxx/types/bson_value/value.hpp>
 #include <iostream>
 #include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <optional>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <atomic>
+#include <queue>
+#include <regex>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <array>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <random>
+
+#ifdef TRACK_ALLOCATIONS
+#include <malloc.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <map>
+
+// Учёт выделений памяти (сборка с -DTRACK_ALLOCATIONS=ON).
+// Подменяем malloc/free glibc, а не только operator new: Eigen и libbson выделяют память
+// через malloc напрямую, а operator new в libstdc++ тоже сводится к malloc.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+struct AllocationCounters {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> frees{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> live{0};
+    std::atomic<int64_t> peak{0};
+};
+
+AllocationCounters allocation_counters;
+thread_local bool allocation_tracking_paused = false;
+
+inline void count_allocation(void* ptr) {
+    if (!ptr || allocation_tracking_paused) {
+        return;
+    }
+    size_t size = malloc_usable_size(ptr);
+    allocation_counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    allocation_counters.bytes.fetch_add(size, std::memory_order_relaxed);
+    int64_t live = allocation_counters.live.fetch_add(size, std::memory_order_relaxed) + size;
+    int64_t peak = allocation_counters.peak.load(std::memory_order_relaxed);
+    while (live > peak && !allocation_counters.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+inline void count_free(void* ptr) {
+    if (!ptr || allocation_tracking_paused) {
+        return;
+    }
+    allocation_counters.frees.fetch_add(1, std::memory_order_relaxed);
+    allocation_counters.live.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+}
+
+extern "C" {
+void* malloc(size_t size) noexcept {
+    void* ptr = __libc_malloc(size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+void* calloc(size_t count, size_t size) noexcept {
+    void* ptr = __libc_calloc(count, size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+// realloc считаем как освобождение старого блока и выделение нового
+void* realloc(void* old, size_t size) noexcept {
+    count_free(old);
+    void* ptr = __libc_realloc(old, size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+    void* ptr = __libc_memalign(alignment, size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) noexcept {
+    void* ptr = memalign(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+void free(void* ptr) noexcept {
+    count_free(ptr);
+    __libc_free(ptr);
+}
+}
+
+// Счётчики выделений на время жизни объекта; итоги копятся по имени области.
+// Счётчики общие для процесса: при работе нескольких потоков в область попадают и их выделения.
+class AllocationScope {
+private:
+    struct Totals {
+        uint64_t calls = 0;
+        uint64_t allocations = 0;
+        uint64_t frees = 0;
+        uint64_t bytes = 0;
+        int64_t peak_bytes = 0;  // наибольший прирост занятой памяти за один вызов
+    };
+
+    const char* name;
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t bytes;
+    int64_t live;
+    int64_t outer_peak;
+
+    static std::map<std::string, Totals>& totals() {
+        static std::map<std::string, Totals> registry;
+        return registry;
+    }
+
+public:
+    explicit AllocationScope(const char* name)
+        : name(name),
+          allocations(allocation_counters.allocations.load()),
+          frees(allocation_counters.frees.load()),
+          bytes(allocation_counters.bytes.load()),
+          live(allocation_counters.live.load()),
+          outer_peak(allocation_counters.peak.exchange(live)) {}
+
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+
+    ~AllocationScope() {
+        int64_t peak = allocation_counters.peak.load();
+        allocation_tracking_paused = true;
+        auto& entry = totals()[name];
+        ++entry.calls;
+        entry.allocations += allocation_counters.allocations.load() - allocations;
+        entry.frees += allocation_counters.frees.load() - frees;
+        entry.bytes += allocation_counters.bytes.load() - bytes;
+        entry.peak_bytes = std::max(entry.peak_bytes, peak - live);
+        allocation_tracking_paused = false;
+        // Пик внешней области не меньше пика вложенной
+        int64_t current = allocation_counters.peak.load();
+        while (current < outer_peak && !allocation_counters.peak.compare_exchange_weak(current, outer_peak)) {
+        }
+    }
+
+    // Итоги по областям, по строке JSON на область
+    static void report(std::ostream& out) {
+        allocation_tracking_paused = true;
+        for (const auto& [scope, entry] : totals()) {
+            out << "{\"scope\":\"" << scope << "\""
+                << ",\"calls\":" << entry.calls
+                << ",\"allocations\":" << entry.allocations
+                << ",\"frees\":" << entry.frees
+                << ",\"bytes\":" << entry.bytes
+                << ",\"peak_bytes\":" << entry.peak_bytes
+                << "}" << std::endl;
+        }
+        allocation_tracking_paused = false;
+    }
+};
+#else
+// Без TRACK_ALLOCATIONS области ничего не считают
+class AllocationScope {
+public:
+    explicit AllocationScope(const char*) {}
+
+    static void report(std::ostream&) {}
+};
+#endif
+
+// Число из элемента (double, int32 или int64); если поля нет или это не число - 0
+double read_number(const bsoncxx::document::element& element) {
+    if (!element) {
+        return 0.0;
+    }
+    switch (element.type()) {
+        case bsoncxx::type::k_double:
+            return element.get_double().value;
+        case bsoncxx::type::k_int32:
+            return element.get_int32().value;
+        case bsoncxx::type::k_int64:
+            return static_cast<double>(element.get_int64().value);
+        default:
+            return 0.0;
+    }
+}
+
+// Пачка студентов в виде столбцов (structure-of-arrays).
+// Буферы переиспользуются: clear() не освобождает память, поэтому повторные пачки
+// декодируются без выделений на каждый документ.
+class StudentBatch {
+private:
+    std::vector<int32_t> ages;
+    std::vector<double> grades;
+    std::vector<uint32_t> group_ids;     // индекс в group_names
+    std::vector<uint32_t> name_offsets;  // ФИО студента i: names[name_offsets[i], name_offsets[i + 1])
+    std::vector<char> names;
+
+    // Словарь групп живёт дольше пачки, поэтому id стабильны между пачками.
+    // deque не перемещает строки, ключи-string_view остаются валидными.
+    std::deque<std::string> group_names;
+    std::unordered_map<std::string_view, uint32_t> group_index;
+
+    void append_name_part(const bsoncxx::document::element& element) {
+        if (element && element.type() == bsoncxx::type::k_string) {
+            auto text = element.get_string().value;
+            if (names.size() != name_offsets.back()) {
+                names.push_back(' ');
+            }
+            names.insert(names.end(), text.begin(), text.end());
+        }
+    }
+
+    uint32_t intern_group(const bsoncxx::document::element& element) {
+        std::string_view group;
+        if (element && element.type() == bsoncxx::type::k_string) {
+            group = element.get_string().value;
+        }
+        auto it = group_index.find(group);
+        if (it != group_index.end()) {
+            return it->second;
+        }
+        uint32_t id = static_cast<uint32_t>(group_names.size());
+        group_names.emplace_back(group);
+        group_index.emplace(group_names.back(), id);
+        return id;
+    }
+
+public:
+    StudentBatch() {
+        name_offsets.push_back(0);
+    }
+
+    void reserve(size_t count) {
+        ages.reserve(count);
+        grades.reserve(count);
+        group_ids.reserve(count);
+        name_offsets.reserve(count + 1);
+        names.reserve(count * 48);
+    }
+
+    void clear() {
+        ages.clear();
+        grades.clear();
+        group_ids.clear();
+        name_offsets.resize(1);
+        names.clear();
+    }
+
+    // Декодируем документ студента в конец столбцов
+    void append(const bsoncxx::document::view& doc) {
+        ages.push_back(static_cast<int32_t>(read_number(doc["Возраст"])));
+        grades.push_back(read_number(doc["Средний_балл"]));
+        group_ids.push_back(intern_group(doc["Группа"]));
+        append_name_part(doc["Фамилия"]);
+        append_name_part(doc["Имя"]);
+        append_name_part(doc["Отчество"]);
+        name_offsets.push_back(static_cast<uint32_t>(names.size()));
+    }
+
+    size_t size() const {
+        return grades.size();
+    }
+
+    const std::vector<int32_t>& age_column() const {
+        return ages;
+    }
+
+    const std::vector<double>& grade_column() const {
+        return grades;
+    }
+
+    const std::vector<uint32_t>& group_column() const {
+        return group_ids;
+    }
+
+    std::string_view full_name(size_t i) const {
+        return std::string_view(names.data() + name_offsets[i], name_offsets[i + 1] - name_offsets[i]);
+    }
+
+    const std::string& group_name(uint32_t id) const {
+        return group_names[id];
+    }
+};
+
+// Фильтр MongoDB, разобранный один раз на весь проход по локальным данным
+class StudentFilter {
+private:
+    struct Condition {
+        std::string field;
+        std::string op;
+        bsoncxx::types::bson_value::value operand;
+        std::regex pattern;
+        std::string prefix;  // литеральный префикс для "^..." (для зон)
+    };
+
+    std::vector<Condition> conditions;
+
+    // Литеральный префикс якорного регулярного выражения: "^Ан" -> "Ан".
+    // Пустой, если совпадение не обязано начинаться с него ("^Ab|Cd")
+    static std::string literal_prefix(const std::string& regex) {
+        if (regex.empty() || regex[0] != '^') {
+            return "";
+        }
+        // '|' вне скобок и классов: вторая ветка не привязана к префиксу первой
+        int depth = 0;
+        bool in_class = false;
+        for (size_t i = 1; i < regex.size(); ++i) {
+            char c = regex[i];
+            if (c == '\\') {
+                ++i;
+            } else if (in_class) {
+                in_class = c != ']';
+            } else if (c == '[') {
+                in_class = true;
+            } else if (c == '(') {
+                ++depth;
+            } else if (c == ')') {
+                --depth;
+            } else if (c == '|' && depth == 0) {
+                return "";
+            }
+        }
+
+        std::string prefix;
+        size_t last = 0;  // начало последнего символа: в UTF-8 он бывает многобайтным
+        for (size_t i = 1; i < regex.size(); ++i) {
+            if (std::string(".[]()*+?{}|\\^$").find(regex[i]) != std::string::npos) {
+                // Квантификатор делает последний символ необязательным - убираем его целиком
+                if (std::string("*?{").find(regex[i]) != std::string::npos) {
+                    prefix.erase(last);
+                }
+                break;
+            }
+            if ((static_cast<unsigned char>(regex[i]) & 0xC0) != 0x80) {
+                last = prefix.size();
+            }
+            prefix += regex[i];
+        }
+        return prefix;
+    }
+
+public:
+    static bool as_number(const bsoncxx::types::bson_value::view& value, double* number) {
+        switch (value.type()) {
+            case bsoncxx::type::k_double:
+                *number = value.get_double().value;
+                return true;
+            case bsoncxx::type::k_int32:
+                *number = value.get_int32().value;
+                return true;
+            case bsoncxx::type::k_int64:
+                *number = static_cast<double>(value.get_int64().value);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Сравнение как в MongoDB для чисел и строк; разные типы несравнимы
+    static bool compare(const bsoncxx::types::bson_value::view& a,
+                        const bsoncxx::types::bson_value::view& b,
+                        int* result) {
+        double x = 0.0;
+        double y = 0.0;
+        if (as_number(a, &x) && as_number(b, &y)) {
+            *result = (x < y) ? -1 : (x > y ? 1 : 0);
+            return true;
+        }
+        if (a.type() == bsoncxx::type::k_string && b.type() == bsoncxx::type::k_string) {
+            int c = a.get_string().value.compare(b.get_string().value);
+            *result = (c < 0) ? -1 : (c > 0 ? 1 : 0);
+            return true;
+        }
+        return false;
+    }
+
+    explicit StudentFilter(const bsoncxx::document::view& filter) {
+        for (auto& element : filter) {
+            std::string field(element.key());
+            if (element.type() != bsoncxx::type::k_document) {
+                // {поле: значение} - проверка на равенство
+                conditions.push_back({field, "$eq", bsoncxx::types::bson_value::value(element.get_value()), {}, ""});
+                continue;
+            }
+            for (auto& op : element.get_document().view()) {
+                Condition condition{field, std::string(op.key()),
+                                    bsoncxx::types::bson_value::value(op.get_value()), {}, ""};
+                if (condition.op == "$regex") {
+                    if (op.type() != bsoncxx::type::k_string) {
+                        throw std::invalid_argument("$regex ожидает строку");
+                    }
+                    std::string regex(op.get_string().value);
+                    condition.pattern = std::regex(regex);
+                    condition.prefix = literal_prefix(regex);
+                } else if (condition.op != "$eq" && condition.op != "$ne" &&
+                           condition.op != "$lt" && condition.op != "$lte" &&
+                           condition.op != "$gt" && condition.op != "$gte") {
+                    throw std::invalid_argument("Оператор не поддерживается локальным фильтром: " + condition.op);
+                }
+                conditions.push_back(std::move(condition));
+            }
+        }
+    }
+
+    bool matches(const bsoncxx::document::view& doc) const {
+        for (const auto& condition : conditions) {
+            auto field = doc[condition.field];
+            if (condition.op == "$ne") {
+                int c = 0;
+                if (field && compare(field.get_value(), condition.operand.view(), &c) && c == 0) {
+                    return false;
+                }
+                continue;
+            }
+            if (!field) {
+                return false;
+            }
+            if (condition.op == "$regex") {
+                if (field.type() != bsoncxx::type::k_string) {
+                    return false;
+                }
+                auto text = field.get_string().value;
+                if (!std::regex_search(text.begin(), text.end(), condition.pattern)) {
+                    return false;
+                }
+                continue;
+            }
+            int c = 0;
+            if (!compare(field.get_value(), condition.operand.view(), &c)) {
+                return false;
+            }
+            bool ok = (condition.op == "$eq" && c == 0) ||
+                      (condition.op == "$lt" && c < 0) ||
+                      (condition.op == "$lte" && c <= 0) ||
+                      (condition.op == "$gt" && c > 0) ||
+                      (condition.op == "$gte" && c >= 0);
+            if (!ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Может ли хоть одна строка с такой зоной {поле: {min, max}} пройти фильтр.
+    // Зона есть только у полей, где все значения в блоке одного сравнимого вида.
+    bool may_match(const bsoncxx::document::view& zones) const {
+        for (const auto& condition : conditions) {
+            auto zone = zones[condition.field];
+            if (!zone || condition.op == "$ne") {
+                continue;
+            }
+            auto min = zone.get_document().view()["min"].get_value();
+            auto max = zone.get_document().view()["max"].get_value();
+
+            if (condition.op == "$regex") {
+                if (condition.prefix.empty() || min.type() != bsoncxx::type::k_string) {
+                    continue;
+                }
+                // Все строки с префиксом p лежат в [p, p + '\xff'...)
+                std::string_view lo = min.get_string().value;
+                std::string_view hi = max.get_string().value;
+                if (hi < condition.prefix ||
+                    (lo > condition.prefix && lo.compare(0, condition.prefix.size(), condition.prefix) > 0)) {
+                    return false;
+                }
+                continue;
+            }
+
+            int lo = 0;
+            int hi = 0;
+            if (!compare(min, condition.operand.view(), &lo) ||
+                !compare(max, condition.operand.view(), &hi)) {
+                // Типы несравнимы ни с одной строкой блока
+                return false;
+            }
+            bool ok = (condition.op == "$eq" && lo <= 0 && hi >= 0) ||
+                      (condition.op == "$lt" && lo < 0) ||
+                      (condition.op == "$lte" && lo <= 0) ||
+                      (condition.op == "$gt" && hi > 0) ||
+                      (condition.op == "$gte" && hi >= 0);
+            if (!ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Именованный отчёт: фильтр и статистика по Средний_балл ("$avg", "$max", "$min", "$sum")
+struct ReportSpec {
+    std::string name;
+    bsoncxx::document::value filter;
+    std::string statistic;
+};
+
+struct ReportResult {
+    std::string name;
+    std::string statistic;
+    int64_t count;
+    double value;
+};
+
+// Бюджет времени запроса: дедлайн (уходит на сервер как maxTimeMS) и флаг отмены,
+// который хранилища проверяют между пачками документов
+class QueryBudget {
+private:
+    std::chrono::steady_clock::time_point deadline;
+    bool limited = false;
+    std::shared_ptr<std::atomic<bool>> cancel_flag;
+
+public:
+    QueryBudget() = default;
+
+    // Без дедлайна, только отмена
+    explicit QueryBudget(std::shared_ptr<std::atomic<bool>> cancel_flag)
+        : cancel_flag(std::move(cancel_flag)) {}
+
+    QueryBudget(std::chrono::milliseconds budget, std::shared_ptr<std::atomic<bool>> cancel_flag)
+        : deadline(std::chrono::steady_clock::now() + budget),
+          limited(true),
+          cancel_flag(std::move(cancel_flag)) {}
+
+    bool cancelled() const {
+        return cancel_flag && cancel_flag->load(std::memory_order_relaxed);
+    }
+
+    bool expired() const {
+        return cancelled() || (limited && std::chrono::steady_clock::now() >= deadline);
+    }
+
+    bool is_limited() const {
+        return limited;
+    }
+
+    // Остаток для maxTimeMS; не меньше 1 мс, иначе 0 значит "без ограничения"
+    std::chrono::milliseconds remaining() const {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        return std::max(left, std::chrono::milliseconds(1));
+    }
+};
+
+// Хранилище студентов: откуда берутся документы для отчётов
+class StudentStore {
+protected:
+    QueryBudget budget;
+    bool truncated_ = false;  // последний обход остановлен по бюджету
+
+    // Проверка между пачками: при исчерпании бюджета помечаем результат частичным
+    bool out_of_budget() {
+        if (budget.expired()) {
+            truncated_ = true;
+        }
+        return truncated_;
+    }
+
+public:
+    using Visitor = std::function<void(const bsoncxx::document::view&)>;
+
+    // Бюджет для следующих запросов
+    virtual void set_budget(const QueryBudget& next) {
+        budget = next;
+    }
+
+    // Был ли последний запрос прерван по дедлайну или отмене (результат частичный)
+    bool truncated() const {
+        return truncated_;
+    }
+
+    bool cancelled() const {
+        return budget.cancelled();
+    }
+
+    // Обходим документы, подходящие под фильтр (пустая проекция - все поля)
+    virtual void scan(const bsoncxx::document::view& filter,
+                      const bsoncxx::document::view& projection,
+                      const Visitor& visit) = 0;
+
+    // Первые k документов по убыванию поля, если хранилище умеет это делать само
+    virtual bool scan_top(const bsoncxx::document::view& /*filter*/,
+                          const bsoncxx::document::view& /*projection*/,
+                          const std::string& /*field*/,
+                          int /*k*/,
+                          const Visitor& /*visit*/) {
+        return false;
+    }
+
+    // Обходим подходящих студентов пачками по batch_size, декодированными в столбцы.
+    // batch принадлежит вызывающему и переиспользуется между вызовами.
+    virtual void scan_batches(const bsoncxx::document::view& filter,
+                              size_t batch_size,
+                              StudentBatch& batch,
+                              const std::function<void(const StudentBatch&)>& visit) {
+        static const auto projection = bsoncxx::builder::basic::make_document(
+            bsoncxx::builder::basic::kvp("_id", 0),
+            bsoncxx::builder::basic::kvp("Фамилия", 1),
+            bsoncxx::builder::basic::kvp("Имя", 1),
+            bsoncxx::builder::basic::kvp("Отчество", 1),
+            bsoncxx::builder::basic::kvp("Возраст", 1),
+            bsoncxx::builder::basic::kvp("Группа", 1),
+            bsoncxx::builder::basic::kvp("Средний_балл", 1)
+        );
+        batch.clear();
+        scan(filter, projection.view(), [&](const bsoncxx::document::view& doc) {
+            batch.append(doc);
+            if (batch.size() == batch_size) {
+                visit(batch);
+                batch.clear();
+            }
+        });
+        if (batch.size() > 0) {
+            visit(batch);
+            batch.clear();
+        }
+    }
+
+    // Несколько отчётов за один проход по данным.
+    // По умолчанию: один полный обход, каждый документ проверяется всеми фильтрами.
+    virtual std::vector<ReportResult> run_reports(const std::vector<ReportSpec>& reports) {
+        std::vector<StudentFilter> filters;
+        std::vector<ReportResult> results;
+        for (const auto& report : reports) {
+            filters.emplace_back(report.filter.view());
+            double start = 0.0;
+            if (report.statistic == "$max") {
+                start = -std::numeric_limits<double>::infinity();
+            } else if (report.statistic == "$min") {
+                start = std::numeric_limits<double>::infinity();
+            }
+            results.push_back({report.name, report.statistic, 0, start});
+        }
+
+        scan(bsoncxx::document::view{}, {}, [&](const bsoncxx::document::view& doc) {
+            double avg = read_number(doc["Средний_балл"]);
+            for (size_t i = 0; i < filters.size(); ++i) {
+                if (!filters[i].matches(doc)) {
+                    continue;
+                }
+                auto& result = results[i];
+                ++result.count;
+                if (result.statistic == "$max") {
+                    result.value = std::max(result.value, avg);
+                } else if (result.statistic == "$min") {
+                    result.value = std::min(result.value, avg);
+                } else {
+                    result.value += avg;
+                }
+            }
+        });
+
+        for (auto& result : results) {
+            if (result.statistic == "$avg" && result.count > 0) {
+                result.value /= result.count;
+            }
+        }
+        return results;
+    }
+
+    // Равномерная выборка до size документов из всего хранилища; возвращает размер хранилища.
+    // По умолчанию - резервуарная выборка за один проход.
+    virtual size_t sample(size_t size, const Visitor& visit) {
+        std::mt19937_64 gen(std::random_device{}());
+        std::vector<bsoncxx::document::value> reservoir;
+        reservoir.reserve(size);
+        size_t seen = 0;
+        scan(bsoncxx::document::view{}, {}, [&](const bsoncxx::document::view& doc) {
+            ++seen;
+            if (reservoir.size() < size) {
+                reservoir.emplace_back(doc);
+            } else {
+                std::uniform_int_distribution<size_t> pick(0, seen - 1);
+                size_t slot = pick(gen);
+                if (slot < size) {
+                    reservoir[slot] = bsoncxx::document::value(doc);
+                }
+            }
+        });
+        for (const auto& doc : reservoir) {
+            visit(doc.view());
+        }
+        return seen;
+    }
+
+    // Идентификатор источника для ключей кэша отчётов; пустой - не кэшировать
+    virtual std::string cache_id() const {
+        return "";
+    }
+
+    virtual ~StudentStore() = default;
+};
+
+// Хранилище поверх коллекции MongoDB
+class MongoStudentStore : public StudentStore {
+private:
+    mongocxx::client client;
+    mongocxx::database db;
+    mongocxx::collection collection;
+    std::string id;
+
+    // Сервер прервал запрос по maxTimeMS (код 50) или истёк наш дедлайн - результат частичный
+    void handle_timeout(const mongocxx::operation_exception& e) {
+        if (e.code().value() != 50 && !budget.expired()) {
+            throw;
+        }
+        truncated_ = true;
+    }
+
+    // Обход курсора с проверкой бюджета между пачками
+    void drain(mongocxx::cursor&& cursor, const Visitor& visit) {
+        size_t seen = 0;
+        try {
+            for (auto& doc : cursor) {
+                visit(doc);
+                if (++seen % check_every == 0 && out_of_budget()) {
+                    return;
+                }
+            }
+        } catch (const mongocxx::operation_exception& e) {
+            handle_timeout(e);
+        }
+    }
+
+    static const size_t check_every = 256;
+
+    // Первые поля индексов коллекции; список запрашивается у сервера один раз,
+    // а не на каждый отчёт
+    std::optional<std::unordered_set<std::string>> index_prefixes;
+
+    // Есть ли индекс, начинающийся с поля field
+    bool has_index_on(const std::string& field) {
+        if (!index_prefixes) {
+            index_prefixes.emplace();
+            for (auto& index : collection.list_indexes()) {
+                if (!index["key"] || index["key"].type() != bsoncxx::type::k_document) {
+                    continue;
+                }
+                auto key = index["key"].get_document().view();
+                auto first = key.begin();
+                if (first != key.end()) {
+                    index_prefixes->insert(std::string(first->key()));
+                }
+            }
+        }
+        return index_prefixes->count(field) > 0;
+    }
+
+public:
+    MongoStudentStore(const std::string& uri,
+                      const std::string& db_name,
+                      const std::string& coll_name)
+        : client{mongocxx::uri{uri}},
+          db{client[db_name]},
+          collection{db[coll_name]},
+          id(uri + "/" + db_name + "." + coll_name) {}
+
+    std::string cache_id() const override {
+        return id;
+    }
+
+    void scan(const bsoncxx::document::view& filter,
+              const bsoncxx::document::view& projection,
+              const Visitor& visit) override {
+        truncated_ = false;
+        mongocxx::options::find opts;
+        if (!projection.empty()) {
+            opts.projection(projection);
+        }
+        if (budget.is_limited()) {
+            opts.max_time(budget.remaining());
+        }
+        drain(collection.find(filter, opts), visit);
+    }
+
+    bool scan_top(const bsoncxx::document::view& filter,
+                  const bsoncxx::document::view& projection,
+                  const std::string& field,
+                  int k,
+                  const Visitor& visit) override {
+        truncated_ = false;
+        // Без индекса сортировка на сервере - тот же полный проход, считаем на клиенте
+        if (!has_index_on(field)) {
+            return false;
+        }
+        mongocxx::options::find opts;
+        opts.sort(bsoncxx::builder::basic::make_document(
+            bsoncxx::builder::basic::kvp(field, -1)
+        ));
+        opts.limit(k);
+        if (!projection.empty()) {
+            opts.projection(projection);
+        }
+        if (budget.is_limited()) {
+            opts.max_time(budget.remaining());
+        }
+        drain(collection.find(filter, opts), visit);
+        return true;
+    }
+
+    // Все отчёты одной агрегацией: $match по объединению фильтров, затем $facet
+    // с отдельной веткой $match + $group на каждый отчёт. Один проход, один ответ.
+    std::vector<ReportResult> run_reports(const std::vector<ReportSpec>& reports) override {
+        bsoncxx::builder::basic::array any;
+        bsoncxx::builder::basic::document facets;
+        for (const auto& report : reports) {
+            any.append(report.filter.view());
+            facets.append(bsoncxx::builder::basic::kvp(report.name, [&](bsoncxx::builder::basic::sub_array stages) {
+                stages.append(
+                    bsoncxx::builder::basic::make_document(
+                        bsoncxx::builder::basic::kvp("$match", report.filter.view())
+                    ),
+                    bsoncxx::builder::basic::make_document(
+                        bsoncxx::builder::basic::kvp("$group", bsoncxx::builder::basic::make_document(
+                            bsoncxx::builder::basic::kvp("_id", bsoncxx::types::b_null{}),
+                            bsoncxx::builder::basic::kvp("count", bsoncxx::builder::basic::make_document(
+                                bsoncxx::builder::basic::kvp("$sum", 1)
+                            )),
+                            bsoncxx::builder::basic::kvp("value", bsoncxx::builder::basic::make_document(
+                                bsoncxx::builder::basic::kvp(report.statistic, "$Средний_балл")
+                            ))
+                        ))
+                    )
+                );
+            }));
+        }
+
+        mongocxx::pipeline pipeline;
+        pipeline.match(bsoncxx::builder::basic::make_document(
+            bsoncxx::builder::basic::kvp("$or", any.view())
+        ));
+        pipeline.facet(facets.extract());
+
+        truncated_ = false;
+        mongocxx::options::aggregate opts;
+        if (budget.is_limited()) {
+            opts.max_time(budget.remaining());
+        }
+        std::vector<ReportResult> results;
+        std::vector<bsoncxx::document::value> responses;
+        drain(collection.aggregate(pipeline, opts), [&](const bsoncxx::document::view& doc) {
+            responses.emplace_back(doc);
+        });
+        if (truncated_) {
+            // $facet отвечает одним документом целиком - частичного ответа нет
+            return results;
+        }
+        for (const auto& response : responses) {
+            auto doc = response.view();
+            for (const auto& report : reports) {
+                ReportResult result{report.name, report.statistic, 0, 0.0};
+                auto groups = doc[report.name];
+                if (groups && groups.type() == bsoncxx::type::k_array) {
+                    for (auto& group : groups.get_array().value) {
+                        auto view = group.get_document().view();
+                        result.count = static_cast<int64_t>(read_number(view["count"]));
+                        result.value = read_number(view["value"]);
+                    }
+                }
+                results.push_back(result);
+            }
+        }
+        return results;
+    }
+
+    // $sample первой стадией: сервер берёт случайные документы, не сканируя коллекцию
+    size_t sample(size_t size, const Visitor& visit) override {
+        mongocxx::pipeline pipeline;
+        pipeline.sample(static_cast<int32_t>(size));
+        truncated_ = false;
+        mongocxx::options::aggregate opts;
+        if (budget.is_limited()) {
+            opts.max_time(budget.remaining());
+        }
+        drain(collection.aggregate(pipeline, opts), visit);
+        return static_cast<size_t>(collection.estimated_document_count());
+    }
+
+    mongocxx::collection& get_collection() {
+        return collection;
+    }
+};
+
+// Хранилище в памяти: документы BSON лежат подряд в одном буфере
+class InMemoryStudentStore : public StudentStore {
+private:
+    std::vector<uint8_t> arena;
+    std::vector<std::pair<size_t, size_t>> documents;  // смещение и длина в arena
+
+    bsoncxx::document::view document(size_t i) const {
+        return bsoncxx::document::view(arena.data() + documents[i].first, documents[i].second);
+    }
+
+    // Зоны {поле: {min, max}} для строк order[begin, end)
+    bsoncxx::document::value build_zones(const std::vector<size_t>& order, size_t begin, size_t end) const {
+        bsoncxx::builder::basic::document zones;
+        for (auto& element : document(order[begin])) {
+            bool numeric = element.type() == bsoncxx::type::k_double ||
+                           element.type() == bsoncxx::type::k_int32 ||
+                           element.type() == bsoncxx::type::k_int64;
+            if (!numeric && element.type() != bsoncxx::type::k_string) {
+                continue;
+            }
+            auto min = element.get_value();
+            auto max = element.get_value();
+            bool complete = true;
+            for (size_t i = begin; i < end && complete; ++i) {
+                auto value = document(order[i])[element.key()];
+                int c_min = 0;
+                int c_max = 0;
+                if (!value ||
+                    !StudentFilter::compare(value.get_value(), min, &c_min) ||
+                    !StudentFilter::compare(value.get_value(), max, &c_max)) {
+                    complete = false;
+                    break;
+                }
+                if (c_min < 0) {
+                    min = value.get_value();
+                }
+                if (c_max > 0) {
+                    max = value.get_value();
+                }
+            }
+            if (complete) {
+                zones.append(bsoncxx::builder::basic::kvp(element.key(), bsoncxx::builder::basic::make_document(
+                    bsoncxx::builder::basic::kvp("min", min),
+                    bsoncxx::builder::basic::kvp("max", max)
+                )));
+            }
+        }
+        return zones.extract();
+    }
+
+public:
+    void reserve(size_t count, size_t bytes) {
+        documents.reserve(count);
+        arena.reserve(bytes);
+    }
+
+    void insert(const bsoncxx::document::view& doc) {
+        documents.emplace_back(arena.size(), doc.length());
+        arena.insert(arena.end(), doc.data(), doc.data() + doc.length());
+    }
+
+    // Снимок коллекции MongoDB в память
+    void load(mongocxx::collection& collection) {
+        for (auto& doc : collection.find(bsoncxx::document::view{})) {
+            insert(doc);
+        }
+    }
+
+    size_t size() const {
+        return documents.size();
+    }
+
+    // Случайные индексы без повторов (алгоритм Флойда): O(size), независимо от размера хранилища
+    size_t sample(size_t size, const Visitor& visit) override {
+        size_t population = documents.size();
+        if (size >= population) {
+            for (size_t i = 0; i < population; ++i) {
+                visit(document(i));
+            }
+            return population;
+        }
+        std::mt19937_64 gen(std::random_device{}());
+        std::unordered_set<size_t> chosen;
+        chosen.reserve(size);
+        for (size_t j = population - size; j < population; ++j) {
+            size_t t = std::uniform_int_distribution<size_t>(0, j)(gen);
+            chosen.insert(chosen.count(t) ? j : t);
+        }
+        for (size_t i : chosen) {
+            visit(document(i));
+        }
+        return population;
+    }
+
+    // Проекция в памяти не нужна: документы не копируются и никуда не передаются
+    void scan(const bsoncxx::document::view& filter,
+              const bsoncxx::document::view&,
+              const Visitor& visit) override {
+        StudentFilter compiled(filter);
+        truncated_ = false;
+        for (size_t i = 0; i < documents.size(); ++i) {
+            if (i % 1024 == 0 && out_of_budget()) {
+                return;
+            }
+            bsoncxx::document::view doc = document(i);
+            if (compiled.matches(doc)) {
+                visit(doc);
+            }
+        }
+    }
+
+    // Пишем снимок на диск группами строк, отсортированными по sort_key.
+    // Формат: "STSNAP01", число групп (uint32), затем для каждой группы
+    // число строк (uint32), зоны как BSON-документ, длина данных (uint64) и сами документы подряд.
+    void save_snapshot(const std::string& path, const std::string& sort_key, size_t rows_per_group = 4096) const {
+        std::vector<size_t> order(documents.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        // Сортировка кластеризует ключ: у групп получаются узкие непересекающиеся зоны
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            auto x = document(a)[sort_key];
+            auto y = document(b)[sort_key];
+            if (!x || !y) {
+                return !x && y;
+            }
+            int c = 0;
+            if (!StudentFilter::compare(x.get_value(), y.get_value(), &c)) {
+                return x.type() < y.type();
+            }
+            return c < 0;
+        });
+
+        std::ofstream out(path, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Не удалось создать снимок: " + path);
+        }
+        uint32_t groups = static_cast<uint32_t>((order.size() + rows_per_group - 1) / rows_per_group);
+        out.write("STSNAP01", 8);
+        out.write(reinterpret_cast<const char*>(&groups), sizeof(groups));
+
+        for (size_t begin = 0; begin < order.size(); begin += rows_per_group) {
+            size_t end = std::min(order.size(), begin + rows_per_group);
+            uint32_t rows = static_cast<uint32_t>(end - begin);
+            auto zones = build_zones(order, begin, end);
+            uint64_t data_length = 0;
+            for (size_t i = begin; i < end; ++i) {
+                data_length += documents[order[i]].second;
+            }
+
+            out.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+            out.write(reinterpret_cast<const char*>(zones.view().data()), zones.view().length());
+            out.write(reinterpret_cast<const char*>(&data_length), sizeof(data_length));
+            for (size_t i = begin; i < end; ++i) {
+                const auto& [offset, length] = documents[order[i]];
+                out.write(reinterpret_cast<const char*>(arena.data() + offset), length);
+            }
+        }
+        if (!out) {
+            throw std::runtime_error("Ошибка записи снимка: " + path);
+        }
+    }
+};
+
+// Снимок на диске: в памяти только зоны, группы строк читаются по требованию
+class SnapshotStudentStore : public StudentStore {
+private:
+    struct RowGroup {
+        uint32_t rows;
+        std::vector<uint8_t> zones;  // BSON {поле: {min, max}}
+        uint64_t offset;             // начало документов в файле
+        uint64_t length;
+    };
+
+    std::string path;
+    std::ifstream file;
+    std::vector<RowGroup> groups;
+    std::vector<uint8_t> buffer;  // переиспользуется между группами
+
+    size_t groups_read = 0;
+    size_t groups_skipped = 0;
+    uint64_t bytes_read = 0;
+
+    static uint32_t read_int32(const uint8_t* data) {
+        return static_cast<uint32_t>(data[0]) |
+               static_cast<uint32_t>(data[1]) << 8 |
+               static_cast<uint32_t>(data[2]) << 16 |
+               static_cast<uint32_t>(data[3]) << 24;
+    }
+
+    [[noreturn]] void corrupted() const {
+        throw std::runtime_error("Снимок повреждён: " + path);
+    }
+
+public:
+    explicit SnapshotStudentStore(const std::string& path)
+        : path(path), file(path, std::ios::binary) {
+        char magic[8];
+        uint32_t count = 0;
+        if (!file.read(magic, sizeof(magic)) || std::string(magic, sizeof(magic)) != "STSNAP01" ||
+            !file.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+            throw std::runtime_error("Не удалось открыть снимок: " + path);
+        }
+
+        // Все длины из файла сверяем с его размером, прежде чем выделять память или читать
+        file.seekg(0, std::ios::end);
+        const uint64_t file_size = static_cast<uint64_t>(file.tellg());
+        file.seekg(sizeof(magic) + sizeof(count));
+        auto remaining = [&] {
+            return file_size - static_cast<uint64_t>(file.tellg());
+        };
+
+        // Заголовок группы - не меньше 17 байт: строки, зоны (от 5 байт) и длина данных
+        if (!file || count > remaining() / 17) {
+            corrupted();
+        }
+        groups.resize(count);
+        for (auto& group : groups) {
+            uint8_t length_bytes[4];
+            file.read(reinterpret_cast<char*>(&group.rows), sizeof(group.rows));
+            file.read(reinterpret_cast<char*>(length_bytes), sizeof(length_bytes));
+            if (!file) {
+                corrupted();
+            }
+            uint32_t zones_length = read_int32(length_bytes);
+            if (zones_length < 5 || zones_length - 4 > remaining()) {
+                corrupted();
+            }
+            group.zones.resize(zones_length);
+            std::copy(length_bytes, length_bytes + 4, group.zones.begin());
+            if (!file.read(reinterpret_cast<char*>(group.zones.data() + 4), group.zones.size() - 4) ||
+                !file.read(reinterpret_cast<char*>(&group.length), sizeof(group.length)) ||
+                group.length > remaining()) {
+                corrupted();
+            }
+            group.offset = static_cast<uint64_t>(file.tellg());
+            file.seekg(static_cast<std::streamoff>(group.length), std::ios::cur);
+            if (!file) {
+                corrupted();
+            }
+        }
+    }
+
+    void scan(const bsoncxx::document::view& filter,
+              const bsoncxx::document::view&,
+              const Visitor& visit) override {
+        StudentFilter compiled(filter);
+        truncated_ = false;
+        for (const auto& group : groups) {
+            if (out_of_budget()) {
+                return;
+            }
+            // Зона не пересекается с фильтром - блок даже не читаем
+            if (!compiled.may_match(bsoncxx::document::view(group.zones.data(), group.zones.size()))) {
+                ++groups_skipped;
+                continue;
+            }
+            ++groups_read;
+            bytes_read += group.length;
+
+            buffer.resize(group.length);
+            file.clear();
+            file.seekg(static_cast<std::streamoff>(group.offset));
+            if (!file.read(reinterpret_cast<char*>(buffer.data()), group.length)) {
+                corrupted();
+            }
+
+            for (size_t pos = 0; pos < buffer.size();) {
+                // Документ BSON - не меньше 5 байт и целиком внутри группы
+                if (buffer.size() - pos < 5) {
+                    corrupted();
+                }
+                uint32_t length = read_int32(buffer.data() + pos);
+                if (length < 5 || length > buffer.size() - pos) {
+                    corrupted();
+                }
+                bsoncxx::document::view doc(buffer.data() + pos, length);
+                if (compiled.matches(doc)) {
+                    visit(doc);
+                }
+                pos += length;
+            }
+        }
+    }
+
+    // Сколько групп прочитано и пропущено по зонам с момента открытия
+    void print_stats() const {
+        uint64_t total = 0;
+        for (const auto& group : groups) {
+            total += group.length;
+        }
+        std::cout << "Групп строк прочитано: " << groups_read
+                  << ", пропущено по зонам: " << groups_skipped
+                  << ", байт прочитано: " << bytes_read
+                  << " (данные снимка: " << total << " байт)"
+                  << std::endl;
+    }
+};
+
+// Найденный по фрагменту ФИО студент; score - доля триграмм запроса, найденных в ФИО
+struct NameMatch {
+    std::string full_name;
+    double score;
+};
+
+// Триграммы ФИО: строчные буквы (Ё = Е), слова дополняются пробелами ("  и", " ив", ..., "ов ").
+// Триграмма упакована в uint64 по 21 бит на символ Unicode.
+std::vector<uint64_t> name_trigrams(const std::string& text) {
+    std::vector<uint64_t> result;
+    std::vector<uint32_t> word;
+    auto flush = [&]() {
+        if (word.empty()) {
+            return;
+        }
+        word.insert(word.begin(), 2, U' ');
+        word.push_back(U' ');
+        for (size_t i = 0; i + 3 <= word.size(); ++i) {
+            result.push_back(static_cast<uint64_t>(word[i]) << 42 |
+                             static_cast<uint64_t>(word[i + 1]) << 21 |
+                             word[i + 2]);
+        }
+        word.clear();
+    };
+
+    for (size_t i = 0; i < text.size();) {
+        // Декодируем UTF-8
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        uint32_t code = c;
+        size_t length = 1;
+        if (c >= 0xF0) {
+            code = c & 0x07;
+            length = 4;
+        } else if (c >= 0xE0) {
+            code = c & 0x0F;
+            length = 3;
+        } else if (c >= 0xC0) {
+            code = c & 0x1F;
+            length = 2;
+        }
+        for (size_t k = 1; k < length && i + k < text.size(); ++k) {
+            code = code << 6 | (static_cast<unsigned char>(text[i + k]) & 0x3F);
+        }
+        i += length;
+
+        if (code >= U'А' && code <= U'Я') {
+            code += U'а' - U'А';
+        } else if (code == U'Ё' || code == U'ё') {
+            code = U'е';
+        } else if (code >= U'A' && code <= U'Z') {
+            code += U'a' - U'A';
+        }
+        bool letter = (code >= U'а' && code <= U'я') || (code >= U'a' && code <= U'z') || (code >= U'0' && code <= U'9');
+        if (letter) {
+            word.push_back(code);
+        } else {
+            flush();
+        }
+    }
+    flush();
+
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+// Ранжирование кандидатов: сначала доля совпавших триграмм запроса,
+// при равенстве - более короткое ФИО (меньше лишних триграмм)
+template <typename TrigramCount, typename FullName>
+std::vector<NameMatch> rank_name_matches(const std::unordered_map<uint32_t, uint32_t>& hits,
+                                         size_t query_size,
+                                         double min_score,
+                                         size_t limit,
+                                         const TrigramCount& trigram_count,
+                                         const FullName& full_name) {
+    struct Candidate {
+        uint32_t id;
+        double score;
+        uint32_t trigrams;
+    };
+    std::vector<Candidate> candidates;
+    for (const auto& [id, count] : hits) {
+        double score = static_cast<double>(count) / query_size;
+        if (score >= min_score) {
+            candidates.push_back({id, score, trigram_count(id)});
+        }
+    }
+    auto better = [](const Candidate& a, const Candidate& b) {
+        if (a.score != b.score) {
+            return a.score > b.score;
+        }
+        if (a.trigrams != b.trigrams) {
+            return a.trigrams < b.trigrams;
+        }
+        return a.id < b.id;
+    };
+    size_t top = std::min(limit, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + top, candidates.end(), better);
+
+    std::vector<NameMatch> result;
+    for (size_t i = 0; i < top; ++i) {
+        result.push_back({full_name(candidates[i].id), candidates[i].score});
+    }
+    return result;
+}
+
+// Триграммный индекс по ФИО для нечёткого поиска (опечатки, фрагменты в любом поле).
+// Поддерживает добавление, изменение и удаление студентов; save() пишет компактный
+// файл, который MappedNameIndex читает через mmap без разбора.
+class NameIndex {
+private:
+    struct Entry {
+        std::string full_name;  // "Фамилия Имя Отчество"
+        uint32_t trigrams;
+        bool removed;
+    };
+
+    std::vector<Entry> entries;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> postings;  // id по возрастанию
+    size_t removed_count = 0;
+
+    void index(uint32_t id) {
+        auto trigrams = name_trigrams(entries[id].full_name);
+        entries[id].trigrams = static_cast<uint32_t>(trigrams.size());
+        for (uint64_t trigram : trigrams) {
+            auto& ids = postings[trigram];
+            ids.insert(std::lower_bound(ids.begin(), ids.end(), id), id);
+        }
+    }
+
+    void unindex(uint32_t id) {
+        for (uint64_t trigram : name_trigrams(entries[id].full_name)) {
+            auto found = postings.find(trigram);
+            if (found == postings.end()) {
+                continue;
+            }
+            auto& ids = found->second;
+            auto position = std::lower_bound(ids.begin(), ids.end(), id);
+            if (position != ids.end() && *position == id) {
+                ids.erase(position);
+            }
+            if (ids.empty()) {
+                postings.erase(found);
+            }
+        }
+    }
+
+    template <typename T>
+    static void append(std::vector<uint8_t>& out, T value) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(value));
+    }
+
+    static std::string join(const std::string& surname, const std::string& name, const std::string& patronymic) {
+        return surname + " " + name + " " + patronymic;
+    }
+
+    static std::string field(const bsoncxx::document::view& doc, const char* key) {
+        auto element = doc[key];
+        if (element && element.type() == bsoncxx::type::k_string) {
+            return std::string(element.get_string().value);
+        }
+        return "";
+    }
+
+public:
+    // Новый студент; возвращает его номер в индексе
+    uint32_t add(const std::string& surname, const std::string& name, const std::string& patronymic) {
+        uint32_t id = static_cast<uint32_t>(entries.size());
+        entries.push_back({join(surname, name, patronymic), 0, false});
+        index(id);
+        return id;
+    }
+
+    uint32_t add(const bsoncxx::document::view& doc) {
+        return add(field(doc, "Фамилия"), field(doc, "Имя"), field(doc, "Отчество"));
+    }
+
+    // Изменение ФИО: пересчитываются только постинги этого студента
+    void update(uint32_t id, const std::string& surname, const std::string& name, const std::string& patronymic) {
+        if (id >= entries.size() || entries[id].removed) {
+            throw std::out_of_range("Нет студента в индексе: " + std::to_string(id));
+        }
+        unindex(id);
+        entries[id].full_name = join(surname, name, patronymic);
+        index(id);
+    }
+
+    void remove(uint32_t id) {
+        if (id >= entries.size() || entries[id].removed) {
+            return;
+        }
+        unindex(id);
+        entries[id].removed = true;
+        entries[id].full_name.clear();
+        ++removed_count;
+    }
+
+    // Индекс по всем студентам хранилища (MongoDB, память или снимок)
+    void build(StudentStore& store) {
+        auto projection = bsoncxx::builder::basic::make_document(
+            bsoncxx::builder::basic::kvp("Фамилия", 1),
+            bsoncxx::builder::basic::kvp("Имя", 1),
+            bsoncxx::builder::basic::kvp("Отчество", 1)
+        );
+        store.scan(bsoncxx::document::view{}, projection.view(), [&](const bsoncxx::document::view& doc) {
+            add(doc);
+        });
+    }
+
+    size_t size() const {
+        return entries.size() - removed_count;
+    }
+
+    // Лучшие limit студентов, у которых найдено не меньше min_score триграмм запроса
+    std::vector<NameMatch> search(const std::string& query, size_t limit = 10, double min_score = 0.5) const {
+        auto trigrams = name_trigrams(query);
+        std::unordered_map<uint32_t, uint32_t> hits;
+        for (uint64_t trigram : trigrams) {
+            auto found = postings.find(trigram);
+            if (found != postings.end()) {
+                for (uint32_t id : found->second) {
+                    ++hits[id];
+                }
+            }
+        }
+        if (trigrams.empty()) {
+            return {};
+        }
+        return rank_name_matches(hits, trigrams.size(), min_score, limit,
+                                 [&](uint32_t id) { return entries[id].trigrams; },
+                                 [&](uint32_t id) { return entries[id].full_name; });
+    }
+
+    // Формат: "STNGRM01", число студентов, триграмм и постингов, длина имён (uint32),
+    // студенты {смещение имени, длина, число триграмм} (uint32), триграммы по возрастанию
+    // {ключ uint64, начало, длина}, постинги (uint32), имена подряд.
+    // Удалённые студенты не пишутся, номера уплотняются.
+    void save(const std::string& path) const {
+        std::vector<uint32_t> remap(entries.size());
+        std::vector<uint32_t> records;
+        std::string names;
+        uint32_t next = 0;
+        for (size_t id = 0; id < entries.size(); ++id) {
+            if (entries[id].removed) {
+                continue;
+            }
+            remap[id] = next++;
+            records.push_back(static_cast<uint32_t>(names.size()));
+            records.push_back(static_cast<uint32_t>(entries[id].full_name.size()));
+            records.push_back(entries[id].trigrams);
+            names += entries[id].full_name;
+        }
+
+        std::vector<uint64_t> keys;
+        keys.reserve(postings.size());
+        for (const auto& posting : postings) {
+            keys.push_back(posting.first);
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<uint8_t> table;
+        std::vector<uint32_t> ids;
+        for (uint64_t key : keys) {
+            const auto& list = postings.at(key);
+            uint32_t start = static_cast<uint32_t>(ids.size());
+            uint32_t count = static_cast<uint32_t>(list.size());
+            for (uint32_t id : list) {
+                ids.push_back(remap[id]);  // уплотнение сохраняет порядок
+            }
+            append(table, key);
+            append(table, start);
+            append(table, count);
+        }
+
+        std::ofstream out(path, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Не удалось создать индекс: " + path);
+        }
+        uint32_t header[] = {next, static_cast<uint32_t>(keys.size()),
+                             static_cast<uint32_t>(ids.size()), static_cast<uint32_t>(names.size())};
+        out.write("STNGRM01", 8);
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(table.data()), table.size());
+        out.write(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(uint32_t));
+        out.write(names.data(), names.size());
+        if (!out) {
+            throw std::runtime_error("Ошибка записи индекса: " + path);
+        }
+    }
+};
+
+// Индекс ФИО из файла NameIndex::save(), отображённый в память: открывается
+// без чтения файла, триграммы ищутся двоичным поиском прямо в отображении
+class MappedNameIndex {
+private:
+    int fd = -1;
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+
+    uint32_t entry_count = 0;
+    uint32_t key_count = 0;
+    const uint8_t* records = nullptr;
+    const uint8_t* keys = nullptr;
+    const uint8_t* ids = nullptr;
+    const uint8_t* names = nullptr;
+
+    static const size_t header_size = 8 + 4 * sizeof(uint32_t);
+    static const size_t key_size = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+    // Поля файла не выровнены - читаем через memcpy
+    template <typename T>
+    static T load(const uint8_t* at) {
+        T value;
+        std::memcpy(&value, at, sizeof(value));
+        return value;
+    }
+
+    void release() {
+        if (data) {
+            ::munmap(const_cast<uint8_t*>(data), length);
+            data = nullptr;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    uint32_t record(uint32_t id, int column) const {
+        return load<uint32_t>(records + (static_cast<size_t>(id) * 3 + column) * sizeof(uint32_t));
+    }
+
+public:
+    explicit MappedNameIndex(const std::string& path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || ::fstat(fd, &info) != 0) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            throw std::runtime_error("Не удалось открыть индекс: " + path);
+        }
+        length = static_cast<size_t>(info.st_size);
+        void* mapped = length > 0 ? ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Не удалось отобразить индекс: " + path);
+        }
+        data = static_cast<const uint8_t*>(mapped);
+
+        if (length < header_size || std::string(reinterpret_cast<const char*>(data), 8) != "STNGRM01") {
+            release();
+            throw std::runtime_error("Индекс повреждён: " + path);
+        }
+        entry_count = load<uint32_t>(data + 8);
+        key_count = load<uint32_t>(data + 12);
+        uint32_t id_count = load<uint32_t>(data + 16);
+        uint32_t names_length = load<uint32_t>(data + 20);
+
+        auto corrupted = [&] {
+            release();
+            throw std::runtime_error("Индекс повреждён: " + path);
+        };
+        // Разделы сверяем с размером файла до того, как строить на них указатели
+        uint64_t expected = header_size + static_cast<uint64_t>(entry_count) * 3 * sizeof(uint32_t) +
+                            static_cast<uint64_t>(key_count) * key_size +
+                            static_cast<uint64_t>(id_count) * sizeof(uint32_t) + names_length;
+        if (expected != length) {
+            corrupted();
+        }
+        records = data + header_size;
+        keys = records + static_cast<size_t>(entry_count) * 3 * sizeof(uint32_t);
+        ids = keys + static_cast<size_t>(key_count) * key_size;
+        names = ids + static_cast<size_t>(id_count) * sizeof(uint32_t);
+
+        // Всё, на что search() переходит по значениям из файла, проверяется один раз здесь:
+        // ФИО внутри раздела имён, списки внутри раздела id, id - номера записей,
+        // таблица триграмм отсортирована (по ней идёт двоичный поиск)
+        for (uint32_t id = 0; id < entry_count; ++id) {
+            if (static_cast<uint64_t>(record(id, 0)) + record(id, 1) > names_length) {
+                corrupted();
+            }
+        }
+        for (uint32_t i = 0; i < key_count; ++i) {
+            const uint8_t* slot = keys + static_cast<size_t>(i) * key_size;
+            uint64_t start = load<uint32_t>(slot + sizeof(uint64_t));
+            uint64_t count = load<uint32_t>(slot + sizeof(uint64_t) + sizeof(uint32_t));
+            if (start + count > id_count ||
+                (i > 0 && load<uint64_t>(slot - key_size) >= load<uint64_t>(slot))) {
+                corrupted();
+            }
+        }
+        for (uint32_t i = 0; i < id_count; ++i) {
+            if (load<uint32_t>(ids + static_cast<size_t>(i) * sizeof(uint32_t)) >= entry_count) {
+                corrupted();
+            }
+        }
+    }
+
+    MappedNameIndex(const MappedNameIndex&) = delete;
+    MappedNameIndex& operator=(const MappedNameIndex&) = delete;
+
+    ~MappedNameIndex() {
+        release();
+    }
+
+    size_t size() const {
+        return entry_count;
+    }
+
+    std::vector<NameMatch> search(const std::string& query, size_t limit = 10, double min_score = 0.5) const {
+        auto trigrams = name_trigrams(query);
+        std::unordered_map<uint32_t, uint32_t> hits;
+        for (uint64_t trigram : trigrams) {
+            // Двоичный поиск по отсортированной таблице триграмм
+            uint32_t low = 0;
+            uint32_t high = key_count;
+            while (low < high) {
+                uint32_t middle = low + (high - low) / 2;
+                if (load<uint64_t>(keys + middle * key_size) < trigram) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            const uint8_t* slot = keys + static_cast<size_t>(low) * key_size;
+            if (low == key_count || load<uint64_t>(slot) != trigram) {
+                continue;
+            }
+            uint32_t start = load<uint32_t>(slot + sizeof(uint64_t));
+            uint32_t count = load<uint32_t>(slot + sizeof(uint64_t) + sizeof(uint32_t));
+            for (uint32_t i = 0; i < count; ++i) {
+                ++hits[load<uint32_t>(ids + (static_cast<size_t>(start) + i) * sizeof(uint32_t))];
+            }
+        }
+        if (trigrams.empty()) {
+            return {};
+        }
+        return rank_name_matches(hits, trigrams.size(), min_score, limit,
+                                 [&](uint32_t id) { return record(id, 2); },
+                                 [&](uint32_t id) {
+                                     return std::string(reinterpret_cast<const char*>(names) + record(id, 0), record(id, 1));
+                                 });
+    }
+};
+
+// Кэш отчётов на диске: файл на ключ, в первой строке - время истечения (unix, секунды).
+// Ключ - хэш канонического BSON фильтра вместе с описанием запроса.
+class ReportCache {
+private:
+    std::filesystem::path dir;
+    std::chrono::seconds ttl;
+    uintmax_t max_bytes;
+
+    // Фильтр с отсортированными ключами: порядок build_filter не влияет на ключ
+    static bsoncxx::document::value canonical(const bsoncxx::document::view& doc) {
+        std::vector<bsoncxx::document::element> elements;
+        for (const auto& element : doc) {
+            elements.push_back(element);
+        }
+        std::sort(elements.begin(), elements.end(), [](const auto& a, const auto& b) {
+            return a.key() < b.key();
+        });
+        bsoncxx::builder::basic::document sorted;
+        for (const auto& element : elements) {
+            if (element.type() == bsoncxx::type::k_document) {
+                sorted.append(bsoncxx::builder::basic::kvp(element.key(), canonical(element.get_document().view())));
+            } else {
+                sorted.append(bsoncxx::builder::basic::kvp(element.key(), element.get_value()));
+            }
+        }
+        return sorted.extract();
+    }
+
+    static void fnv1a(uint64_t* hash, const uint8_t* data, size_t length) {
+        for (size_t i = 0; i < length; ++i) {
+            *hash ^= data[i];
+            *hash *= 1099511628211ULL;
+        }
+    }
+
+    std::filesystem::path entry_path(uint64_t key) const {
+        std::ostringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') << key << ".report";
+        return dir / name.str();
+    }
+
+    static int64_t now_seconds() {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Удаляем давно не читанные записи, пока кэш не влезет в max_bytes
+    void evict() {
+        std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> entries;
+        uintmax_t total = 0;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+            if (entry.path().extension() != ".report") {
+                continue;
+            }
+            total += entry.file_size(error);
+            entries.emplace_back(entry.last_write_time(error), entry.path());
+        }
+        std::sort(entries.begin(), entries.end());
+        for (const auto& [time, path] : entries) {
+            if (total <= max_bytes) {
+                break;
+            }
+            uintmax_t size = std::filesystem::file_size(path, error);
+            if (std::filesystem::remove(path, error)) {
+                total -= size;
+            }
+        }
+    }
+
+public:
+    ReportCache(const std::filesystem::path& dir,
+                std::chrono::seconds ttl = std::chrono::seconds(300),
+                uintmax_t max_bytes = 16 * 1024 * 1024)
+        : dir(dir), ttl(ttl), max_bytes(max_bytes) {
+        std::filesystem::create_directories(dir);
+    }
+
+    static uint64_t key(const std::string& source,
+                        const std::vector<bsoncxx::document::view>& filters,
+                        const std::string& request) {
+        uint64_t hash = 14695981039346656037ULL;
+        fnv1a(&hash, reinterpret_cast<const uint8_t*>(source.data()), source.size() + 1);
+        for (const auto& filter : filters) {
+            auto sorted = canonical(filter);
+            fnv1a(&hash, sorted.view().data(), sorted.view().length());
+        }
+        fnv1a(&hash, reinterpret_cast<const uint8_t*>(request.data()), request.size());
+        return hash;
+    }
+
+    // Текст отчёта, если запись есть и не истекла
+    std::optional<std::string> get(uint64_t key) {
+        std::filesystem::path path = entry_path(key);
+        std::ifstream in(path, std::ios::binary);
+        int64_t expires = 0;
+        if (!in || !(in >> expires) || in.get() != '\n') {
+            return std::nullopt;
+        }
+        if (expires < now_seconds()) {
+            in.close();
+            std::error_code error;
+            std::filesystem::remove(path, error);
+            return std::nullopt;
+        }
+        std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        // Отмечаем чтение для вытеснения давно не используемых записей
+        std::error_code error;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+        return text;
+    }
+
+    void put(uint64_t key, const std::string& text) {
+        std::filesystem::path path = entry_path(key);
+        std::filesystem::path temp = path;
+        temp += ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            out << now_seconds() + ttl.count() << '\n' << text;
+            if (!out) {
+                return;
+            }
+        }
+        // Переименование атомарно: параллельный читатель не увидит полузаписанный файл
+        std::error_code error;
+        std::filesystem::rename(temp, path, error);
+        evict();
+    }
+};
+
+// Что делать с кэшем отчётов
+enum class CacheMode {
+    Use,      // читать и записывать
+    Bypass,   // не трогать кэш
+    Refresh   // пересчитать и перезаписать
+};
 
 // Класс для работы с MongoDB
 class MongoDBHandler {
 private:
-    mongocxx::instance instance;
-    mongocxx::client client;
-    mongocxx::database db;
-    mongocxx::collection collection;
+    std::unique_ptr<StudentStore> store;
     bsoncxx::builder::basic::document filter_;  // Фильтр как поле класса
+    StudentBatch batch_;  // столбцы для отчётов, переиспользуются между вызовами
+    std::vector<ReportSpec> reports_;  // отчёты, ждущие print_reports()
+    std::unique_ptr<ReportCache> cache;
+    CacheMode cache_mode = CacheMode::Bypass;
+    static const size_t batch_size = 1024;
+    std::chrono::milliseconds timeout_{10000};  // бюджет одного отчёта, 0 - без ограничения
+    std::shared_ptr<std::atomic<bool>> cancel_flag = std::make_shared<std::atomic<bool>>(false);
+
+    // Студент с ФИО и средним баллом (для отчётов топ-K)
+    struct StudentScore {
+        std::string surname;
+        std::string name;
+        std::string patronymic;
+        double grade;
+    };
+
+    static std::string read_string(const bsoncxx::document::view& doc, const std::string& field) {
+        auto element = doc[field];
+        if (element && element.type() == bsoncxx::type::k_string) {
+            return std::string(element.get_string().value);
+        }
+        return "";
+    }
+
+    static StudentScore read_student(const bsoncxx::document::view& doc) {
+        return StudentScore{
+            read_string(doc, "Фамилия"),
+            read_string(doc, "Имя"),
+            read_string(doc, "Отчество"),
+            read_number(doc["Средний_балл"])
+        };
+    }
+
+    // Проекция: только ФИО и средний балл
+    static bsoncxx::document::value name_projection() {
+        return bsoncxx::builder::basic::make_document(
+            bsoncxx::builder::basic::kvp("_id", 0),
+            bsoncxx::builder::basic::kvp("Фамилия", 1),
+            bsoncxx::builder::basic::kvp("Имя", 1),
+            bsoncxx::builder::basic::kvp("Отчество", 1),
+            bsoncxx::builder::basic::kvp("Средний_балл", 1)
+        );
+    }
+
+    // Новый бюджет на каждый отчёт: дедлайн считается от начала запроса,
+    // отмена прошлого запроса на новый не распространяется
+    void start_budget() {
+        cancel_flag->store(false);
+        if (timeout_.count() > 0) {
+            store->set_budget(QueryBudget(timeout_, cancel_flag));
+        } else {
+            store->set_budget(QueryBudget(cancel_flag));
+        }
+    }
+
+    // Предупреждение о частичном результате; true, если запрос был прерван
+    bool warn_if_truncated() {
+        if (!store->truncated()) {
+            return false;
+        }
+        if (store->cancelled()) {
+            std::cout << "Внимание: запрос отменён, результат частичный." << std::endl;
+        } else {
+            std::cout << "Внимание: бюджет времени запроса (" << timeout_.count()
+                      << " мс) исчерпан, результат частичный." << std::endl;
+        }
+        return true;
+    }
+
+    // Отчёт через кэш: при попадании выводим сохранённый текст без обращения к хранилищу,
+    // иначе считаем отчёт и сохраняем его вывод. Прерванный по бюджету отчёт не кэшируется.
+    void cached(const std::string& request,
+                const std::vector<bsoncxx::document::view>& filters,
+                const std::function<void(std::ostream&)>& report) {
+        std::string source = store->cache_id();
+        if (!cache || cache_mode == CacheMode::Bypass || source.empty()) {
+            start_budget();
+            report(std::cout);
+            warn_if_truncated();
+            return;
+        }
+        uint64_t key = ReportCache::key(source, filters, request);
+        if (cache_mode == CacheMode::Use) {
+            if (auto text = cache->get(key)) {
+                std::cout << *text;
+                return;
+            }
+        }
+        std::ostringstream out;
+        start_budget();
+        report(out);
+        std::cout << out.str();
+        if (!warn_if_truncated()) {
+            cache->put(key, out.str());
+        }
+    }
 
 public:
     // Конструктор
     MongoDBHandler(const std::string& uri,
                    const std::string& db_name,
                    const std::string& coll_name)
-        : client{mongocxx::uri{uri}},
-          db{client[db_name]},
-          collection{db[coll_name]} {}
+        : store(std::make_unique<MongoStudentStore>(uri, db_name, coll_name)) {
+        batch_.reserve(batch_size);
+    }
+
+    // Конструктор с произвольным хранилищем (например, в памяти)
+    explicit MongoDBHandler(std::unique_ptr<StudentStore> store)
+        : store(std::move(store)) {
+        batch_.reserve(batch_size);
+    }
+
+    // Кэш отчётов на диске; mode управляет чтением и записью (см. CacheMode)
+    void enable_cache(const std::filesystem::path& dir,
+                      CacheMode mode,
+                      std::chrono::seconds ttl = std::chrono::seconds(300)) {
+        cache = std::make_unique<ReportCache>(dir, ttl);
+        cache_mode = mode;
+    }
+
+    // Бюджет времени на каждый отчёт; 0 - без ограничения
+    void set_timeout(std::chrono::milliseconds timeout) {
+        timeout_ = timeout;
+    }
+
+    // Отмена текущего запроса (можно вызывать из другого потока)
+    void cancel() {
+        cancel_flag->store(true);
+    }
 
     // Добавляем условие в фильтр
     void build_filter(
@@ -47,74 +1966,431 @@ public:
 
     // Выводим студентов
     void print_average() {
-        auto cursor = collection.find(filter_.view());
+        AllocationScope allocations("MongoDBHandler::print_average");
+        cached("average", {filter_.view()}, [&](std::ostream& out) {
+            double count = 0;
+            double totalAverage = 0.0;
+
+            store->scan_batches(filter_.view(), batch_size, batch_, [&](const StudentBatch& batch) {
+                count += batch.size();
+                for (double avg : batch.grade_column()) {
+                    totalAverage += avg;
+                }
+            });
 
-        double count = 0;
-        double totalAverage = 0.0;
+            if (count > 0) {
+                double groupAverage = totalAverage / count;
+                out << "Итого студентов: " << count
+                    << ", средний балл по выборке: "
+                    << std::fixed << std::setprecision(2) << groupAverage
+                    << std::defaultfloat
+                    << std::endl;
+            } else {
+                out << "По заданному фильтру студентов не найдено." << std::endl;
+            }
+        });
+    }
 
-        for (auto& doc : cursor) {
-            count+=1;
-            double avg = 0.0;
-            if (doc["Средний_балл"]) {
-                if (doc["Средний_балл"].type() == bsoncxx::type::k_double) {
-                    avg = doc["Средний_балл"].get_double().value;
-                } else {
-                    avg = static_cast<double>(doc["Средний_балл"].get_int32().value);
+
+    void print_max() {
+        AllocationScope allocations("MongoDBHandler::print_max");
+        cached("max", {filter_.view()}, [&](std::ostream& out) {
+            // Метод выводящий максимальный средний балл студента в выборке
+            double maxAverage = 0.0;
+            int count = 0;
+            store->scan_batches(filter_.view(), batch_size, batch_, [&](const StudentBatch& batch) {
+                // Поиск максимального среднего балла
+                count += static_cast<int>(batch.size());
+                for (double avg : batch.grade_column()) {
+                    if (avg > maxAverage) {
+                        maxAverage = avg;
+                    }
                 }
+            });
+
+            if (count > 0) {   
+                // Вывод максимального среднего балла
+                out << "Максимальный средний балл среди найденных студентов: "
+                    << std::fixed << std::setprecision(2) << maxAverage
+                    << std::defaultfloat
+                    << std::endl;
+            } else {
+                out << "По заданному фильтру студентов не найдено." << std::endl;
             }
-            totalAverage += avg;
-        }
+        });
+    }
 
-        if (count > 0) {
-            double groupAverage = totalAverage / count;
-            std::cout << "Итого студентов: " << count
-                      << ", средний балл по выборке: "
-                      << std::fixed << std::setprecision(2) << groupAverage
-                      << std::defaultfloat
-                      << std::endl;
-        } else {
-            std::cout << "По заданному фильтру студентов не найдено." << std::endl;
+    // Запоминаем текущий фильтр как именованный отчёт; statistic - "$avg", "$max", "$min" или "$sum"
+    void add_report(const std::string& name, const std::string& statistic) {
+        if (name.empty() || name[0] == '$' || name.find('.') != std::string::npos) {
+            throw std::invalid_argument("Недопустимое имя отчёта: " + name);
         }
+        if (statistic != "$avg" && statistic != "$max" && statistic != "$min" && statistic != "$sum") {
+            throw std::invalid_argument("Неизвестная статистика: " + statistic);
+        }
+        reports_.push_back({name, bsoncxx::document::value(filter_.view()), statistic});
     }
 
+    // Выполняем все накопленные отчёты за один запрос и выводим их по именам
+    void print_reports() {
+        AllocationScope allocations("MongoDBHandler::print_reports");
+        if (reports_.empty()) {
+            return;
+        }
+        std::vector<bsoncxx::document::view> filters;
+        std::string request = "reports";
+        for (const auto& report : reports_) {
+            filters.push_back(report.filter.view());
+            request += ":" + report.name + "=" + report.statistic;
+        }
 
-    void print_max() {
-        // Метод выводящий максимальный средний балл студента в выборке
-        auto cursor = collection.find(filter_.view());
+        cached(request, filters, [&](std::ostream& out) {
+            std::vector<ReportResult> results = store->run_reports(reports_);
 
-        double maxAverage = 0.0;
-        int count = 0;
-        for (auto& doc : cursor) {
-            // Поиск максимального среднего балла
-            ++count;
-            double avg = 0.0;
-            if (doc["Средний_балл"]) {
-                if (doc["Средний_балл"].type() == bsoncxx::type::k_double) {
-                    avg = doc["Средний_балл"].get_double().value;
+            for (const auto& result : results) {
+                out << "Студенты: " << result.name << std::endl;
+                if (result.count == 0) {
+                    out << "По заданному фильтру студентов не найдено." << std::endl;
+                    continue;
+                }
+                out << "Итого студентов: " << result.count << ", ";
+                if (result.statistic == "$avg") {
+                    out << "средний балл по выборке: ";
+                } else if (result.statistic == "$max") {
+                    out << "максимальный средний балл: ";
+                } else if (result.statistic == "$min") {
+                    out << "минимальный средний балл: ";
                 } else {
-                    avg = static_cast<double>(doc["Средний_балл"].get_int32().value);
+                    out << "сумма средних баллов: ";
                 }
+                out << std::fixed << std::setprecision(2) << result.value
+                    << std::defaultfloat
+                    << std::endl;
+            }
+        });
+        reports_.clear();
+    }
+
+    // Приближённые средний и максимальный баллы по случайной выборке sample_size студентов.
+    // Фильтр применяется к выборке, поэтому время не зависит от размера коллекции;
+    // погрешность выводится явно (95% доверительные интервалы).
+    void print_approximate(size_t sample_size) {
+        AllocationScope allocations("MongoDBHandler::print_approximate");
+        const double z = 1.96;
+        StudentFilter filter(filter_.view());
+
+        size_t sampled = 0;
+        size_t matched = 0;
+        double sum = 0.0;
+        double sum_squares = 0.0;
+        double maxAverage = 0.0;
+        start_budget();
+        size_t population = store->sample(sample_size, [&](const bsoncxx::document::view& doc) {
+            ++sampled;
+            if (!filter.matches(doc)) {
+                return;
             }
-            if (avg > maxAverage) {
+            double avg = read_number(doc["Средний_балл"]);
+            ++matched;
+            sum += avg;
+            sum_squares += avg * avg;
+            if (matched == 1 || avg > maxAverage) {
                 maxAverage = avg;
             }
+        });
+
+        std::cout << "Приближённый отчёт: выборка " << sampled << " из ~" << population
+                  << ", подходит под фильтр: " << matched << std::endl;
+        warn_if_truncated();
+        if (sampled == 0) {
+            std::cout << "Хранилище пусто." << std::endl;
+            return;
         }
 
-        if (count > 0) {   
-            // Вывод максимального среднего балла
-            std::cout << "Максимальный средний балл среди найденных студентов: "
-                      << std::fixed << std::setprecision(2) << maxAverage
-                      << std::defaultfloat
-                      << std::endl;
-        } else {
-            std::cout << "По заданному фильтру студентов не найдено." << std::endl;
+        // Число подходящих студентов: доля в выборке, нормальное приближение
+        double p = static_cast<double>(matched) / sampled;
+        double p_error = z * std::sqrt(p * (1.0 - p) / sampled);
+        double fpc = population > 1 ? std::sqrt(static_cast<double>(population - std::min(population, sampled)) / (population - 1)) : 0.0;
+        double count_low = std::max(0.0, p - p_error * fpc) * population;
+        double count_high = std::min(1.0, p + p_error * fpc) * population;
+        std::cout << std::fixed << std::setprecision(0)
+                  << "  студентов: ~" << p * population
+                  << " [" << count_low << "; " << count_high << "]"
+                  << std::defaultfloat << std::endl;
+
+        if (matched == 0) {
+            // Правило трёх: при 0 попаданий доля подходящих не больше 3/n с 95% уверенностью
+            std::cout << "  в выборке нет подходящих студентов (во всей коллекции их не больше ~"
+                      << std::fixed << std::setprecision(0) << 3.0 / sampled * population
+                      << std::defaultfloat << ")" << std::endl;
+            return;
+        }
+
+        double mean = sum / matched;
+        double variance = matched > 1 ? std::max(0.0, (sum_squares - matched * mean * mean) / (matched - 1)) : 0.0;
+        double mean_error = z * std::sqrt(variance / matched) * fpc;
+        std::cout << std::fixed << std::setprecision(2)
+                  << "  средний балл: " << mean << " ± " << mean_error
+                  << " [" << mean - mean_error << "; " << mean + mean_error << "]";
+        if (matched < 30) {
+            std::cout << " (мало наблюдений, интервал ненадёжен)";
+        }
+        std::cout << std::endl;
+
+        // Максимум выборки - только нижняя оценка настоящего максимума
+        std::cout << "  максимальный средний балл: не меньше " << maxAverage
+                  << " (выше него не более ~" << std::setprecision(1) << 300.0 / matched
+                  << "% подходящих студентов)"
+                  << std::defaultfloat << std::endl;
+    }
+
+    // Топ-K студентов по среднему баллу вместе с ФИО
+    void print_top_k(int k) {
+        AllocationScope allocations("MongoDBHandler::print_top_k");
+        if (k <= 0) {
+            return;
         }
+
+        cached("top:" + std::to_string(k), {filter_.view()}, [&](std::ostream& out) {
+            std::vector<StudentScore> top;
+            auto projection = name_projection();
+            // Если хранилище умеет сортировку с limit по индексу - отдаём её ему
+            bool sorted = store->scan_top(filter_.view(), projection.view(), "Средний_балл", k,
+                                          [&](const bsoncxx::document::view& doc) {
+                top.push_back(read_student(doc));
+            });
+
+            if (!sorted) {
+                // Иначе min-heap фиксированного размера, память O(K)
+                auto cmp = [](const StudentScore& a, const StudentScore& b) {
+                    return a.grade > b.grade;
+                };
+                std::priority_queue<StudentScore, std::vector<StudentScore>, decltype(cmp)> heap(cmp);
+
+                store->scan(filter_.view(), projection.view(), [&](const bsoncxx::document::view& doc) {
+                    double avg = read_number(doc["Средний_балл"]);
+                    if (static_cast<int>(heap.size()) < k) {
+                        heap.push(read_student(doc));
+                    } else if (avg > heap.top().grade) {
+                        heap.pop();
+                        heap.push(read_student(doc));
+                    }
+                });
+
+                top.reserve(heap.size());
+                while (!heap.empty()) {
+                    top.push_back(heap.top());
+                    heap.pop();
+                }
+                std::reverse(top.begin(), top.end());
+            }
+
+            if (!top.empty()) {
+                out << "Топ-" << k << " студентов по среднему баллу:" << std::endl;
+                for (size_t i = 0; i < top.size(); ++i) {
+                    out << "  " << i + 1 << ". "
+                        << top[i].surname << " " << top[i].name << " " << top[i].patronymic
+                        << ": " << std::fixed << std::setprecision(2) << top[i].grade
+                        << std::defaultfloat
+                        << std::endl;
+                }
+            } else {
+                out << "По заданному фильтру студентов не найдено." << std::endl;
+            }
+        });
     }
 };
 
-int main() {
+// Синтетические студенты для прогона отчётов без MongoDB
+void fill_synthetic_students(InMemoryStudentStore& store, size_t count) {
+    const std::vector<std::string> names = {"Алексей", "Мария", "Дмитрий", "Елена", "Сергей", "Анна", "Павел", "Ольга"};
+    const std::vector<std::string> surnames = {"Андреев", "Антонова", "Борисов", "Васильева", "Григорьев", "Алексеева", "Дмитриев", "Егорова"};
+    const std::vector<std::string> patronymics = {"Сергеевич", "Владимировна", "Александрович", "Игоревна", "Петрович", "Дмитриевна"};
+    const std::vector<std::string> groups = {"ИТ-20-1", "ИТ-20-2", "ИТ-21-1", "ИТ-21-2"};
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> age(17, 23);
+    std::uniform_real_distribution<double> grade(40.0, 100.0);
+
+    store.reserve(count, count * 160);
+    for (size_t i = 0; i < count; ++i) {
+        auto doc = bsoncxx::builder::basic::make_document(
+            bsoncxx::builder::basic::kvp("Имя", names[gen() % names.size()]),
+            bsoncxx::builder::basic::kvp("Фамилия", surnames[gen() % surnames.size()]),
+            bsoncxx::builder::basic::kvp("Отчество", patronymics[gen() % patronymics.size()]),
+            bsoncxx::builder::basic::kvp("Возраст", age(gen)),
+            bsoncxx::builder::basic::kvp("Группа", groups[gen() % groups.size()]),
+            bsoncxx::builder::basic::kvp("Средний_балл", grade(gen))
+        );
+        store.insert(doc.view());
+    }
+}
+
+// Самопроверка пропуска групп строк по зонам: группа, где фильтр может совпасть,
+// не должна отбрасываться. Возвращает число провалившихся проверок.
+int run_self_test() {
+    struct Case {
+        std::string regex;
+        std::string min;
+        std::string max;
+        bool expected;
+    };
+    const std::vector<Case> cases = {
+        {"^Ab|Cd", "Cd", "Cz", true},       // вторая ветка альтернативы не начинается с "Ab"
+        {"^Ан?", "Ас", "Аш", true},         // без необязательной "н" остаётся префикс "А"
+        {"^Ан", "Ас", "Аш", false},         // обязательный префикс по-прежнему отсекает группу
+        {"^Ан", "Ан", "Ань", true},
+    };
+    int failed = 0;
+    for (const auto& c : cases) {
+        auto filter = bsoncxx::builder::basic::make_document(
+            bsoncxx::builder::basic::kvp("Фамилия", bsoncxx::builder::basic::make_document(
+                bsoncxx::builder::basic::kvp("$regex", c.regex)
+            ))
+        );
+        auto zones = bsoncxx::builder::basic::make_document(
+            bsoncxx::builder::basic::kvp("Фамилия", bsoncxx::builder::basic::make_document(
+                bsoncxx::builder::basic::kvp("min", c.min),
+                bsoncxx::builder::basic::kvp("max", c.max)
+            ))
+        );
+        bool result = StudentFilter(filter.view()).may_match(zones.view());
+        if (result != c.expected) {
+            ++failed;
+        }
+        std::cout << (result == c.expected ? "OK     " : "ОШИБКА ") << c.regex
+                  << " в зоне [" << c.min << "; " << c.max << "]: " << (result ? "читать" : "пропустить")
+                  << std::endl;
+    }
+    return failed;
+}
+
+int main(int argc, char* argv[]) {
     try {
-        MongoDBHandler handler("mongodb://localhost:27017", "university", "students");
+        mongocxx::instance instance{};
+
+        // Режимы:
+        //   --memory N                    те же отчёты по N синтетическим студентам в памяти, без mongod
+        //   --write-snapshot FILE [KEY]   записать снимок (из памяти при --memory, иначе из MongoDB),
+        //                                 группы строк отсортированы по KEY (по умолчанию Возраст)
+        //   --snapshot FILE               отчёты по снимку на диске с пропуском групп по зонам
+        //   --approx S                    приближённые отчёты по случайной выборке из S студентов
+        //   --no-cache / --refresh-cache  не использовать кэш отчётов / пересчитать и перезаписать его
+        //   --timeout MS                  бюджет времени на отчёт (по умолчанию 10000, 0 - без ограничения)
+        //   --build-name-index FILE       построить триграммный индекс ФИО по хранилищу и записать его
+        //   --find ТЕКСТ                  нечёткий поиск студентов по фрагменту ФИО; с --name-index FILE
+        //                                 по готовому индексу (mmap), иначе индекс строится в памяти
+        //   --self-test                   проверить пропуск групп снимка по зонам и выйти
+        CacheMode cache_mode = CacheMode::Use;
+        long long timeout_ms = 10000;
+        size_t memory_count = 0;
+        size_t approx_size = 0;
+        std::string snapshot_path;
+        std::string write_path;
+        std::string sort_key = "Возраст";
+        std::string name_index_path;
+        std::string build_index_path;
+        std::string find_query;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--memory" && i + 1 < argc) {
+                memory_count = std::stoul(argv[++i]);
+            } else if (arg == "--self-test") {
+                return run_self_test() == 0 ? 0 : 1;
+            } else if (arg == "--no-cache") {
+                cache_mode = CacheMode::Bypass;
+            } else if (arg == "--refresh-cache") {
+                cache_mode = CacheMode::Refresh;
+            } else if (arg == "--build-name-index" && i + 1 < argc) {
+                build_index_path = argv[++i];
+            } else if (arg == "--name-index" && i + 1 < argc) {
+                name_index_path = argv[++i];
+            } else if (arg == "--find" && i + 1 < argc) {
+                find_query = argv[++i];
+            } else if (arg == "--timeout" && i + 1 < argc) {
+                timeout_ms = std::stoll(argv[++i]);
+            } else if (arg == "--approx" && i + 1 < argc) {
+                approx_size = std::stoul(argv[++i]);
+            } else if (arg == "--snapshot" && i + 1 < argc) {
+                snapshot_path = argv[++i];
+            } else if (arg == "--write-snapshot" && i + 1 < argc) {
+                write_path = argv[++i];
+                if (i + 1 < argc && argv[i + 1][0] != '-') {
+                    sort_key = argv[++i];
+                }
+            } else {
+                std::cerr << "Неизвестный аргумент: " << arg << std::endl;
+                return 1;
+            }
+        }
+
+        if (!write_path.empty()) {
+            InMemoryStudentStore memory;
+            if (memory_count > 0) {
+                fill_synthetic_students(memory, memory_count);
+            } else {
+                MongoStudentStore mongo("mongodb://localhost:27017", "university", "students");
+                memory.load(mongo.get_collection());
+            }
+            memory.save_snapshot(write_path, sort_key);
+            std::cout << "Снимок записан: " << write_path << " (" << memory.size()
+                      << " студентов, сортировка по " << sort_key << ")" << std::endl;
+            return 0;
+        }
+
+        bool timed = memory_count > 0 || !snapshot_path.empty() || approx_size > 0;
+        SnapshotStudentStore* snapshot = nullptr;
+        std::unique_ptr<StudentStore> store;
+        if (!snapshot_path.empty()) {
+            auto disk = std::make_unique<SnapshotStudentStore>(snapshot_path);
+            snapshot = disk.get();
+            store = std::move(disk);
+        } else if (memory_count > 0) {
+            auto memory = std::make_unique<InMemoryStudentStore>();
+            fill_synthetic_students(*memory, memory_count);
+            store = std::move(memory);
+        } else {
+            store = std::make_unique<MongoStudentStore>("mongodb://localhost:27017", "university", "students");
+        }
+
+        if (!build_index_path.empty() || !find_query.empty()) {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<NameMatch> matches;
+            if (!find_query.empty() && !name_index_path.empty() && build_index_path.empty()) {
+                MappedNameIndex index(name_index_path);
+                matches = index.search(find_query);
+            } else {
+                NameIndex index;
+                index.build(*store);
+                if (!build_index_path.empty()) {
+                    index.save(build_index_path);
+                    std::cout << "Индекс ФИО записан: " << build_index_path << " (" << index.size()
+                              << " студентов)" << std::endl;
+                }
+                if (!find_query.empty()) {
+                    matches = index.search(find_query);
+                }
+            }
+            if (!find_query.empty()) {
+                std::cout << "Поиск: " << find_query << std::endl;
+                if (matches.empty()) {
+                    std::cout << "Похожих студентов не найдено." << std::endl;
+                }
+                for (const auto& match : matches) {
+                    std::cout << "  " << match.full_name << " (совпадение "
+                              << std::fixed << std::setprecision(0) << match.score * 100 << "%)"
+                              << std::defaultfloat << std::endl;
+                }
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Время: " << std::fixed << std::setprecision(3) << ms << " мс"
+                      << std::defaultfloat << std::endl;
+            return 0;
+        }
+
+        MongoDBHandler handler(std::move(store));
+        handler.enable_cache(".report_cache", cache_mode);
+        handler.set_timeout(std::chrono::milliseconds(timeout_ms));
 
         std::cout << "Студенты: возраст < 19" << std::endl;
 
@@ -128,11 +2404,27 @@ int main() {
             19
         );
 
-        handler.print_average();
-        handler.print_max();
+        auto start = std::chrono::steady_clock::now();
+        if (approx_size > 0) {
+            handler.print_approximate(approx_size);
+        } else {
+            handler.print_average();
+            handler.print_max();
+            handler.print_top_k(3);
+        }
+
+        if (timed) {
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Время отчётов: " << std::fixed << std::setprecision(3) << ms << " мс"
+                      << std::defaultfloat << std::endl;
+        }
+        if (snapshot) {
+            snapshot->print_stats();
+        }
+        AllocationScope::report(std::cerr);
 
     } catch (const std::exception& e) {
         std::cerr << "Ошибка: " << e.what() << std::endl;
     }
 
-}
+}
\ No newline at end of file
@@ -2,36 +2,1089 @@
 #include <mongocxx/instance.hpp>
 #include <mongocxx/uri.hpp>
 #include <mongocxx/collection.hpp>
+#include <mongocxx/options/find.hpp>
+#include <mongocxx/pipeline.hpp>
+#include <mongocxx/options/aggregate.hpp>
+#include <mongocxx/exception/operation_exception.hpp>
 #include <bsoncxx/json.hpp>
 #include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/types.hpp>
 #include <bsoncxx/types/bson_value/value.hpp>
 #include <iostream>
 #include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <optional>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <future>
+#include <mutex>
+#include <atomic>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <array>
+#include <chrono>
 
-class MongoDBHandler {
+#ifdef TRACK_ALLOCATIONS
+#include <malloc.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <map>
+
+// Учёт выделений памяти (сборка с -DTRACK_ALLOCATIONS=ON).
+// Подменяем malloc/free glibc, а не только operator new: Eigen и libbson выделяют память
+// через malloc напрямую, а operator new в libstdc++ тоже сводится к malloc.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+struct AllocationCounters {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> frees{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> live{0};
+    std::atomic<int64_t> peak{0};
+};
+
+AllocationCounters allocation_counters;
+thread_local bool allocation_tracking_paused = false;
+
+inline void count_allocation(void* ptr) {
+    if (!ptr || allocation_tracking_paused) {
+        return;
+    }
+    size_t size = malloc_usable_size(ptr);
+    allocation_counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    allocation_counters.bytes.fetch_add(size, std::memory_order_relaxed);
+    int64_t live = allocation_counters.live.fetch_add(size, std::memory_order_relaxed) + size;
+    int64_t peak = allocation_counters.peak.load(std::memory_order_relaxed);
+    while (live > peak && !allocation_counters.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+inline void count_free(void* ptr) {
+    if (!ptr || allocation_tracking_paused) {
+        return;
+    }
+    allocation_counters.frees.fetch_add(1, std::memory_order_relaxed);
+    allocation_counters.live.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+}
+
+extern "C" {
+void* malloc(size_t size) noexcept {
+    void* ptr = __libc_malloc(size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+void* calloc(size_t count, size_t size) noexcept {
+    void* ptr = __libc_calloc(count, size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+// realloc считаем как освобождение старого блока и выделение нового
+void* realloc(void* old, size_t size) noexcept {
+    count_free(old);
+    void* ptr = __libc_realloc(old, size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+    void* ptr = __libc_memalign(alignment, size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) noexcept {
+    void* ptr = memalign(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+void free(void* ptr) noexcept {
+    count_free(ptr);
+    __libc_free(ptr);
+}
+}
+
+// Счётчики выделений на время жизни объекта; итоги копятся по имени области.
+// Счётчики общие для процесса: при работе нескольких потоков в область попадают и их выделения.
+class AllocationScope {
+private:
+    struct Totals {
+        uint64_t calls = 0;
+        uint64_t allocations = 0;
+        uint64_t frees = 0;
+        uint64_t bytes = 0;
+        int64_t peak_bytes = 0;  // наибольший прирост занятой памяти за один вызов
+    };
+
+    const char* name;
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t bytes;
+    int64_t live;
+    int64_t outer_peak;
+
+    static std::map<std::string, Totals>& totals() {
+        static std::map<std::string, Totals> registry;
+        return registry;
+    }
+
+public:
+    explicit AllocationScope(const char* name)
+        : name(name),
+          allocations(allocation_counters.allocations.load()),
+          frees(allocation_counters.frees.load()),
+          bytes(allocation_counters.bytes.load()),
+          live(allocation_counters.live.load()),
+          outer_peak(allocation_counters.peak.exchange(live)) {}
+
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+
+    ~AllocationScope() {
+        int64_t peak = allocation_counters.peak.load();
+        allocation_tracking_paused = true;
+        auto& entry = totals()[name];
+        ++entry.calls;
+        entry.allocations += allocation_counters.allocations.load() - allocations;
+        entry.frees += allocation_counters.frees.load() - frees;
+        entry.bytes += allocation_counters.bytes.load() - bytes;
+        entry.peak_bytes = std::max(entry.peak_bytes, peak - live);
+        allocation_tracking_paused = false;
+        // Пик внешней области не меньше пика вложенной
+        int64_t current = allocation_counters.peak.load();
+        while (current < outer_peak && !allocation_counters.peak.compare_exchange_weak(current, outer_peak)) {
+        }
+    }
+
+    // Итоги по областям, по строке JSON на область
+    static void report(std::ostream& out) {
+        allocation_tracking_paused = true;
+        for (const auto& [scope, entry] : totals()) {
+            out << "{\"scope\":\"" << scope << "\""
+                << ",\"calls\":" << entry.calls
+                << ",\"allocations\":" << entry.allocations
+                << ",\"frees\":" << entry.frees
+                << ",\"bytes\":" << entry.bytes
+                << ",\"peak_bytes\":" << entry.peak_bytes
+                << "}" << std::endl;
+        }
+        allocation_tracking_paused = false;
+    }
+};
+#else
+// Без TRACK_ALLOCATIONS области ничего не считают
+class AllocationScope {
+public:
+    explicit AllocationScope(const char*) {}
+
+    static void report(std::ostream&) {}
+};
+#endif
+
+// Число из элемента (double, int32 или int64); если поля нет или это не число - 0
+double read_number(const bsoncxx::document::element& element) {
+    if (!element) {
+        return 0.0;
+    }
+    switch (element.type()) {
+        case bsoncxx::type::k_double:
+            return element.get_double().value;
+        case bsoncxx::type::k_int32:
+            return element.get_int32().value;
+        case bsoncxx::type::k_int64:
+            return static_cast<double>(element.get_int64().value);
+        default:
+            return 0.0;
+    }
+}
+
+// Пачка студентов в виде столбцов (structure-of-arrays).
+// Буферы переиспользуются: clear() не освобождает память, поэтому повторные пачки
+// декодируются без выделений на каждый документ.
+class StudentBatch {
+private:
+    std::vector<int32_t> ages;
+    std::vector<double> grades;
+    std::vector<uint32_t> group_ids;     // индекс в group_names
+    std::vector<uint32_t> name_offsets;  // ФИО студента i: names[name_offsets[i], name_offsets[i + 1])
+    std::vector<char> names;
+
+    // Словарь групп живёт дольше пачки, поэтому id стабильны между пачками.
+    // deque не перемещает строки, ключи-string_view остаются валидными.
+    std::deque<std::string> group_names;
+    std::unordered_map<std::string_view, uint32_t> group_index;
+
+    void append_name_part(const bsoncxx::document::element& element) {
+        if (element && element.type() == bsoncxx::type::k_string) {
+            auto text = element.get_string().value;
+            if (names.size() != name_offsets.back()) {
+                names.push_back(' ');
+            }
+            names.insert(names.end(), text.begin(), text.end());
+        }
+    }
+
+    uint32_t intern_group(const bsoncxx::document::element& element) {
+        std::string_view group;
+        if (element && element.type() == bsoncxx::type::k_string) {
+            group = element.get_string().value;
+        }
+        auto it = group_index.find(group);
+        if (it != group_index.end()) {
+            return it->second;
+        }
+        uint32_t id = static_cast<uint32_t>(group_names.size());
+        group_names.emplace_back(group);
+        group_index.emplace(group_names.back(), id);
+        return id;
+    }
+
+public:
+    StudentBatch() {
+        name_offsets.push_back(0);
+    }
+
+    void reserve(size_t count) {
+        ages.reserve(count);
+        grades.reserve(count);
+        group_ids.reserve(count);
+        name_offsets.reserve(count + 1);
+        names.reserve(count * 48);
+    }
+
+    void clear() {
+        ages.clear();
+        grades.clear();
+        group_ids.clear();
+        name_offsets.resize(1);
+        names.clear();
+    }
+
+    // Декодируем документ студента в конец столбцов
+    void append(const bsoncxx::document::view& doc) {
+        ages.push_back(static_cast<int32_t>(read_number(doc["Возраст"])));
+        grades.push_back(read_number(doc["Средний_балл"]));
+        group_ids.push_back(intern_group(doc["Группа"]));
+        append_name_part(doc["Фамилия"]);
+        append_name_part(doc["Имя"]);
+        append_name_part(doc["Отчество"]);
+        name_offsets.push_back(static_cast<uint32_t>(names.size()));
+    }
+
+    size_t size() const {
+        return grades.size();
+    }
+
+    const std::vector<int32_t>& age_column() const {
+        return ages;
+    }
+
+    const std::vector<double>& grade_column() const {
+        return grades;
+    }
+
+    const std::vector<uint32_t>& group_column() const {
+        return group_ids;
+    }
+
+    std::string_view full_name(size_t i) const {
+        return std::string_view(names.data() + name_offsets[i], name_offsets[i + 1] - name_offsets[i]);
+    }
+
+    const std::string& group_name(uint32_t id) const {
+        return group_names[id];
+    }
+};
+
+// Фильтр MongoDB, разобранный один раз на весь проход по локальным данным
+class StudentFilter {
+private:
+    struct Condition {
+        std::string field;
+        std::string op;
+        bsoncxx::types::bson_value::value operand;
+        std::regex pattern;
+    };
+
+    std::vector<Condition> conditions;
+
+public:
+    static bool as_number(const bsoncxx::types::bson_value::view& value, double* number) {
+        switch (value.type()) {
+            case bsoncxx::type::k_double:
+                *number = value.get_double().value;
+                return true;
+            case bsoncxx::type::k_int32:
+                *number = value.get_int32().value;
+                return true;
+            case bsoncxx::type::k_int64:
+                *number = static_cast<double>(value.get_int64().value);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Сравнение как в MongoDB для чисел и строк; разные типы несравнимы
+    static bool compare(const bsoncxx::types::bson_value::view& a,
+                        const bsoncxx::types::bson_value::view& b,
+                        int* result) {
+        double x = 0.0;
+        double y = 0.0;
+        if (as_number(a, &x) && as_number(b, &y)) {
+            *result = (x < y) ? -1 : (x > y ? 1 : 0);
+            return true;
+        }
+        if (a.type() == bsoncxx::type::k_string && b.type() == bsoncxx::type::k_string) {
+            int c = a.get_string().value.compare(b.get_string().value);
+            *result = (c < 0) ? -1 : (c > 0 ? 1 : 0);
+            return true;
+        }
+        return false;
+    }
+
+    explicit StudentFilter(const bsoncxx::document::view& filter) {
+        for (auto& element : filter) {
+            std::string field(element.key());
+            if (element.type() != bsoncxx::type::k_document) {
+                // {поле: значение} - проверка на равенство
+                conditions.push_back({field, "$eq", bsoncxx::types::bson_value::value(element.get_value()), {}});
+                continue;
+            }
+            for (auto& op : element.get_document().view()) {
+                Condition condition{field, std::string(op.key()),
+                                    bsoncxx::types::bson_value::value(op.get_value()), {}};
+                if (condition.op == "$regex") {
+                    if (op.type() != bsoncxx::type::k_string) {
+                        throw std::invalid_argument("$regex ожидает строку");
+                    }
+                    std::string regex(op.get_string().value);
+                    condition.pattern = std::regex(regex);
+                } else if (condition.op != "$eq" && condition.op != "$ne" &&
+                           condition.op != "$lt" && condition.op != "$lte" &&
+                           condition.op != "$gt" && condition.op != "$gte") {
+                    throw std::invalid_argument("Оператор не поддерживается локальным фильтром: " + condition.op);
+                }
+                conditions.push_back(std::move(condition));
+            }
+        }
+    }
+
+    bool matches(const bsoncxx::document::view& doc) const {
+        for (const auto& condition : conditions) {
+            auto field = doc[condition.field];
+            if (condition.op == "$ne") {
+                int c = 0;
+                if (field && compare(field.get_value(), condition.operand.view(), &c) && c == 0) {
+                    return false;
+                }
+                continue;
+            }
+            if (!field) {
+                return false;
+            }
+            if (condition.op == "$regex") {
+                if (field.type() != bsoncxx::type::k_string) {
+                    return false;
+                }
+                auto text = field.get_string().value;
+                if (!std::regex_search(text.begin(), text.end(), condition.pattern)) {
+                    return false;
+                }
+                continue;
+            }
+            int c = 0;
+            if (!compare(field.get_value(), condition.operand.view(), &c)) {
+                return false;
+            }
+            bool ok = (condition.op == "$eq" && c == 0) ||
+                      (condition.op == "$lt" && c < 0) ||
+                      (condition.op == "$lte" && c <= 0) ||
+                      (condition.op == "$gt" && c > 0) ||
+                      (condition.op == "$gte" && c >= 0);
+            if (!ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Именованный отчёт: фильтр и статистика по Средний_балл ("$avg", "$max", "$min", "$sum")
+struct ReportSpec {
+    std::string name;
+    bsoncxx::document::value filter;
+    std::string statistic;
+};
+
+struct ReportResult {
+    std::string name;
+    std::string statistic;
+    int64_t count;
+    double value;
+};
+
+// Бюджет времени запроса: дедлайн (уходит на сервер как maxTimeMS) и флаг отмены,
+// который хранилища проверяют между пачками документов
+class QueryBudget {
+private:
+    std::chrono::steady_clock::time_point deadline;
+    bool limited = false;
+    std::shared_ptr<std::atomic<bool>> cancel_flag;
+
+public:
+    QueryBudget() = default;
+
+    // Без дедлайна, только отмена
+    explicit QueryBudget(std::shared_ptr<std::atomic<bool>> cancel_flag)
+        : cancel_flag(std::move(cancel_flag)) {}
+
+    QueryBudget(std::chrono::milliseconds budget, std::shared_ptr<std::atomic<bool>> cancel_flag)
+        : deadline(std::chrono::steady_clock::now() + budget),
+          limited(true),
+          cancel_flag(std::move(cancel_flag)) {}
+
+    bool cancelled() const {
+        return cancel_flag && cancel_flag->load(std::memory_order_relaxed);
+    }
+
+    bool expired() const {
+        return cancelled() || (limited && std::chrono::steady_clock::now() >= deadline);
+    }
+
+    bool is_limited() const {
+        return limited;
+    }
+
+    // Остаток для maxTimeMS; не меньше 1 мс, иначе 0 значит "без ограничения"
+    std::chrono::milliseconds remaining() const {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        return std::max(left, std::chrono::milliseconds(1));
+    }
+};
+
+// Хранилище студентов: откуда берутся документы для отчётов
+class StudentStore {
+protected:
+    QueryBudget budget;
+    bool truncated_ = false;  // последний обход остановлен по бюджету
+
+    // Проверка между пачками: при исчерпании бюджета помечаем результат частичным
+    bool out_of_budget() {
+        if (budget.expired()) {
+            truncated_ = true;
+        }
+        return truncated_;
+    }
+
+public:
+    using Visitor = std::function<void(const bsoncxx::document::view&)>;
+
+    // Бюджет для следующих запросов
+    virtual void set_budget(const QueryBudget& next) {
+        budget = next;
+    }
+
+    // Был ли последний запрос прерван по дедлайну или отмене (результат частичный)
+    bool truncated() const {
+        return truncated_;
+    }
+
+    bool cancelled() const {
+        return budget.cancelled();
+    }
+
+    // Обходим документы, подходящие под фильтр (пустая проекция - все поля)
+    virtual void scan(const bsoncxx::document::view& filter,
+                      const bsoncxx::document::view& projection,
+                      const Visitor& visit) = 0;
+
+    // Обходим подходящих студентов пачками по batch_size, декодированными в столбцы.
+    // batch принадлежит вызывающему и переиспользуется между вызовами.
+    virtual void scan_batches(const bsoncxx::document::view& filter,
+                              size_t batch_size,
+                              StudentBatch& batch,
+                              const std::function<void(const StudentBatch&)>& visit) {
+        static const auto projection = bsoncxx::builder::basic::make_document(
+            bsoncxx::builder::basic::kvp("_id", 0),
+            bsoncxx::builder::basic::kvp("Фамилия", 1),
+            bsoncxx::builder::basic::kvp("Имя", 1),
+            bsoncxx::builder::basic::kvp("Отчество", 1),
+            bsoncxx::builder::basic::kvp("Возраст", 1),
+            bsoncxx::builder::basic::kvp("Группа", 1),
+            bsoncxx::builder::basic::kvp("Средний_балл", 1)
+        );
+        batch.clear();
+        scan(filter, projection.view(), [&](const bsoncxx::document::view& doc) {
+            batch.append(doc);
+            if (batch.size() == batch_size) {
+                visit(batch);
+                batch.clear();
+            }
+        });
+        if (batch.size() > 0) {
+            visit(batch);
+            batch.clear();
+        }
+    }
+
+    // Несколько отчётов за один проход по данным.
+    // По умолчанию: один полный обход, каждый документ проверяется всеми фильтрами.
+    virtual std::vector<ReportResult> run_reports(const std::vector<ReportSpec>& reports) {
+        std::vector<StudentFilter> filters;
+        std::vector<ReportResult> results;
+        for (const auto& report : reports) {
+            filters.emplace_back(report.filter.view());
+            double start = 0.0;
+            if (report.statistic == "$max") {
+                start = -std::numeric_limits<double>::infinity();
+            } else if (report.statistic == "$min") {
+                start = std::numeric_limits<double>::infinity();
+            }
+            results.push_back({report.name, report.statistic, 0, start});
+        }
+
+        scan(bsoncxx::document::view{}, {}, [&](const bsoncxx::document::view& doc) {
+            double avg = read_number(doc["Средний_балл"]);
+            for (size_t i = 0; i < filters.size(); ++i) {
+                if (!filters[i].matches(doc)) {
+                    continue;
+                }
+                auto& result = results[i];
+                ++result.count;
+                if (result.statistic == "$max") {
+                    result.value = std::max(result.value, avg);
+                } else if (result.statistic == "$min") {
+                    result.value = std::min(result.value, avg);
+                } else {
+                    result.value += avg;
+                }
+            }
+        });
+
+        for (auto& result : results) {
+            if (result.statistic == "$avg" && result.count > 0) {
+                result.value /= result.count;
+            }
+        }
+        return results;
+    }
+
+    // Идентификатор источника для ключей кэша отчётов; пустой - не кэшировать
+    virtual std::string cache_id() const {
+        return "";
+    }
+
+    virtual ~StudentStore() = default;
+};
+
+// Хранилище поверх коллекции MongoDB
+class MongoStudentStore : public StudentStore {
 private:
-    mongocxx::instance instance;
     mongocxx::client client;
     mongocxx::database db;
     mongocxx::collection collection;
-    bsoncxx::builder::basic::document filter_;
+    std::string id;
+
+    // Сервер прервал запрос по maxTimeMS (код 50) или истёк наш дедлайн - результат частичный
+    void handle_timeout(const mongocxx::operation_exception& e) {
+        if (e.code().value() != 50 && !budget.expired()) {
+            throw;
+        }
+        truncated_ = true;
+    }
+
+    // Обход курсора с проверкой бюджета между пачками
+    void drain(mongocxx::cursor&& cursor, const Visitor& visit) {
+        size_t seen = 0;
+        try {
+            for (auto& doc : cursor) {
+                visit(doc);
+                if (++seen % check_every == 0 && out_of_budget()) {
+                    return;
+                }
+            }
+        } catch (const mongocxx::operation_exception& e) {
+            handle_timeout(e);
+        }
+    }
+
+    static const size_t check_every = 256;
+
+public:
+    MongoStudentStore(const std::string& uri,
+                      const std::string& db_name,
+                      const std::string& coll_name)
+        : client{mongocxx::uri{uri}},
+          db{client[db_name]},
+          collection{db[coll_name]},
+          id(uri + "/" + db_name + "." + coll_name) {}
+
+    std::string cache_id() const override {
+        return id;
+    }
+
+    void scan(const bsoncxx::document::view& filter,
+              const bsoncxx::document::view& projection,
+              const Visitor& visit) override {
+        truncated_ = false;
+        mongocxx::options::find opts;
+        if (!projection.empty()) {
+            opts.projection(projection);
+        }
+        if (budget.is_limited()) {
+            opts.max_time(budget.remaining());
+        }
+        drain(collection.find(filter, opts), visit);
+    }
+
+    // Все отчёты одной агрегацией: $match по объединению фильтров, затем $facet
+    // с отдельной веткой $match + $group на каждый отчёт. Один проход, один ответ.
+    std::vector<ReportResult> run_reports(const std::vector<ReportSpec>& reports) override {
+        bsoncxx::builder::basic::array any;
+        bsoncxx::builder::basic::document facets;
+        for (const auto& report : reports) {
+            any.append(report.filter.view());
+            facets.append(bsoncxx::builder::basic::kvp(report.name, [&](bsoncxx::builder::basic::sub_array stages) {
+                stages.append(
+                    bsoncxx::builder::basic::make_document(
+                        bsoncxx::builder::basic::kvp("$match", report.filter.view())
+                    ),
+                    bsoncxx::builder::basic::make_document(
+                        bsoncxx::builder::basic::kvp("$group", bsoncxx::builder::basic::make_document(
+                            bsoncxx::builder::basic::kvp("_id", bsoncxx::types::b_null{}),
+                            bsoncxx::builder::basic::kvp("count", bsoncxx::builder::basic::make_document(
+                                bsoncxx::builder::basic::kvp("$sum", 1)
+                            )),
+                            bsoncxx::builder::basic::kvp("value", bsoncxx::builder::basic::make_document(
+                                bsoncxx::builder::basic::kvp(report.statistic, "$Средний_балл")
+                            ))
+                        ))
+                    )
+                );
+            }));
+        }
+
+        mongocxx::pipeline pipeline;
+        pipeline.match(bsoncxx::builder::basic::make_document(
+            bsoncxx::builder::basic::kvp("$or", any.view())
+        ));
+        pipeline.facet(facets.extract());
+
+        truncated_ = false;
+        mongocxx::options::aggregate opts;
+        if (budget.is_limited()) {
+            opts.max_time(budget.remaining());
+        }
+        std::vector<ReportResult> results;
+        std::vector<bsoncxx::document::value> responses;
+        drain(collection.aggregate(pipeline, opts), [&](const bsoncxx::document::view& doc) {
+            responses.emplace_back(doc);
+        });
+        if (truncated_) {
+            // $facet отвечает одним документом целиком - частичного ответа нет
+            return results;
+        }
+        for (const auto& response : responses) {
+            auto doc = response.view();
+            for (const auto& report : reports) {
+                ReportResult result{report.name, report.statistic, 0, 0.0};
+                auto groups = doc[report.name];
+                if (groups && groups.type() == bsoncxx::type::k_array) {
+                    for (auto& group : groups.get_array().value) {
+                        auto view = group.get_document().view();
+                        result.count = static_cast<int64_t>(read_number(view["count"]));
+                        result.value = read_number(view["value"]);
+                    }
+                }
+                results.push_back(result);
+            }
+        }
+        return results;
+    }
+};
+
+// Несколько хранилищ (например, базы разных кампусов) как одно: каждый запрос
+// уходит во все параллельно, время отчёта - время самого медленного.
+// Частичные агрегаты сливаются: count и sum складываются, max/min берутся по всем,
+// среднее считается из суммарных sum и count. Отчёты бывают только с $avg/$max/$min/$sum,
+// а эти агрегаты сливаются точно; квантилей и числа различных значений нет, поэтому
+// и приближённые скетчи здесь не нужны.
+class FanOutStudentStore : public StudentStore {
+private:
+    std::vector<std::unique_ptr<StudentStore>> shards;
+
+    // f(shard, номер) для всех хранилищ параллельно; первая ошибка пробрасывается
+    template <typename F>
+    void for_each_shard(F f) {
+        std::vector<std::future<void>> tasks;
+        for (size_t i = 0; i < shards.size(); ++i) {
+            tasks.push_back(std::async(std::launch::async, [&, i] { f(*shards[i], i); }));
+        }
+        for (auto& task : tasks) {
+            task.wait();
+        }
+        truncated_ = false;
+        for (const auto& shard : shards) {
+            truncated_ = truncated_ || shard->truncated();
+        }
+        for (auto& task : tasks) {
+            task.get();
+        }
+    }
+
+public:
+    void add(std::unique_ptr<StudentStore> shard) {
+        shards.push_back(std::move(shard));
+    }
+
+    size_t size() const {
+        return shards.size();
+    }
+
+    void set_budget(const QueryBudget& next) override {
+        StudentStore::set_budget(next);
+        for (auto& shard : shards) {
+            shard->set_budget(next);
+        }
+    }
+
+    // Хранилища читаются параллельно, visit вызывается по одному документу за раз
+    void scan(const bsoncxx::document::view& filter,
+              const bsoncxx::document::view& projection,
+              const Visitor& visit) override {
+        std::mutex visit_mutex;
+        for_each_shard([&](StudentStore& shard, size_t) {
+            shard.scan(filter, projection, [&](const bsoncxx::document::view& doc) {
+                std::lock_guard<std::mutex> lock(visit_mutex);
+                visit(doc);
+            });
+        });
+    }
+
+    std::vector<ReportResult> run_reports(const std::vector<ReportSpec>& reports) override {
+        // Среднее не сливается - у хранилищ спрашиваем сумму и делим в конце
+        std::vector<ReportSpec> partial;
+        for (const auto& report : reports) {
+            std::string statistic = report.statistic == "$avg" ? "$sum" : report.statistic;
+            partial.push_back({report.name, bsoncxx::document::value(report.filter.view()), statistic});
+        }
+
+        std::vector<std::vector<ReportResult>> answers(shards.size());
+        for_each_shard([&](StudentStore& shard, size_t i) {
+            answers[i] = shard.run_reports(partial);
+        });
+
+        std::vector<ReportResult> results;
+        for (size_t r = 0; r < reports.size(); ++r) {
+            ReportResult merged{reports[r].name, reports[r].statistic, 0, 0.0};
+            for (const auto& answer : answers) {
+                if (r >= answer.size() || answer[r].count == 0) {
+                    continue;  // пустое или прерванное хранилище не влияет на max/min
+                }
+                const auto& part = answer[r];
+                if (merged.count == 0) {
+                    merged.value = part.value;
+                } else if (merged.statistic == "$max") {
+                    merged.value = std::max(merged.value, part.value);
+                } else if (merged.statistic == "$min") {
+                    merged.value = std::min(merged.value, part.value);
+                } else {
+                    merged.value += part.value;
+                }
+                merged.count += part.count;
+            }
+            if (merged.statistic == "$avg" && merged.count > 0) {
+                merged.value /= merged.count;
+            }
+            results.push_back(merged);
+        }
+        return results;
+    }
+
+    // Кэшируем, только если у всех хранилищ есть идентификатор
+    std::string cache_id() const override {
+        std::string id = "fanout";
+        for (const auto& shard : shards) {
+            std::string part = shard->cache_id();
+            if (part.empty()) {
+                return "";
+            }
+            id += "|" + part;
+        }
+        return id;
+    }
+};
+
+// Кэш отчётов на диске: файл на ключ, в первой строке - время истечения (unix, секунды).
+// Ключ - хэш канонического BSON фильтра вместе с описанием запроса.
+class ReportCache {
+private:
+    std::filesystem::path dir;
+    std::chrono::seconds ttl;
+    uintmax_t max_bytes;
+
+    // Фильтр с отсортированными ключами: порядок build_filter не влияет на ключ
+    static bsoncxx::document::value canonical(const bsoncxx::document::view& doc) {
+        std::vector<bsoncxx::document::element> elements;
+        for (const auto& element : doc) {
+            elements.push_back(element);
+        }
+        std::sort(elements.begin(), elements.end(), [](const auto& a, const auto& b) {
+            return a.key() < b.key();
+        });
+        bsoncxx::builder::basic::document sorted;
+        for (const auto& element : elements) {
+            if (element.type() == bsoncxx::type::k_document) {
+                sorted.append(bsoncxx::builder::basic::kvp(element.key(), canonical(element.get_document().view())));
+            } else {
+                sorted.append(bsoncxx::builder::basic::kvp(element.key(), element.get_value()));
+            }
+        }
+        return sorted.extract();
+    }
+
+    static void fnv1a(uint64_t* hash, const uint8_t* data, size_t length) {
+        for (size_t i = 0; i < length; ++i) {
+            *hash ^= data[i];
+            *hash *= 1099511628211ULL;
+        }
+    }
+
+    std::filesystem::path entry_path(uint64_t key) const {
+        std::ostringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') << key << ".report";
+        return dir / name.str();
+    }
+
+    static int64_t now_seconds() {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Удаляем давно не читанные записи, пока кэш не влезет в max_bytes
+    void evict() {
+        std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> entries;
+        uintmax_t total = 0;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+            if (entry.path().extension() != ".report") {
+                continue;
+            }
+            total += entry.file_size(error);
+            entries.emplace_back(entry.last_write_time(error), entry.path());
+        }
+        std::sort(entries.begin(), entries.end());
+        for (const auto& [time, path] : entries) {
+            if (total <= max_bytes) {
+                break;
+            }
+            uintmax_t size = std::filesystem::file_size(path, error);
+            if (std::filesystem::remove(path, error)) {
+                total -= size;
+            }
+        }
+    }
+
+public:
+    ReportCache(const std::filesystem::path& dir,
+                std::chrono::seconds ttl = std::chrono::seconds(300),
+                uintmax_t max_bytes = 16 * 1024 * 1024)
+        : dir(dir), ttl(ttl), max_bytes(max_bytes) {
+        std::filesystem::create_directories(dir);
+    }
+
+    static uint64_t key(const std::string& source,
+                        const std::vector<bsoncxx::document::view>& filters,
+                        const std::string& request) {
+        uint64_t hash = 14695981039346656037ULL;
+        fnv1a(&hash, reinterpret_cast<const uint8_t*>(source.data()), source.size() + 1);
+        for (const auto& filter : filters) {
+            auto sorted = canonical(filter);
+            fnv1a(&hash, sorted.view().data(), sorted.view().length());
+        }
+        fnv1a(&hash, reinterpret_cast<const uint8_t*>(request.data()), request.size());
+        return hash;
+    }
+
+    // Текст отчёта, если запись есть и не истекла
+    std::optional<std::string> get(uint64_t key) {
+        std::filesystem::path path = entry_path(key);
+        std::ifstream in(path, std::ios::binary);
+        int64_t expires = 0;
+        if (!in || !(in >> expires) || in.get() != '\n') {
+            return std::nullopt;
+        }
+        if (expires < now_seconds()) {
+            in.close();
+            std::error_code error;
+            std::filesystem::remove(path, error);
+            return std::nullopt;
+        }
+        std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        // Отмечаем чтение для вытеснения давно не используемых записей
+        std::error_code error;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+        return text;
+    }
+
+    void put(uint64_t key, const std::string& text) {
+        std::filesystem::path path = entry_path(key);
+        std::filesystem::path temp = path;
+        temp += ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            out << now_seconds() + ttl.count() << '\n' << text;
+            if (!out) {
+                return;
+            }
+        }
+        // Переименование атомарно: параллельный читатель не увидит полузаписанный файл
+        std::error_code error;
+        std::filesystem::rename(temp, path, error);
+        evict();
+    }
+};
+
+// Что делать с кэшем отчётов
+enum class CacheMode {
+    Use,      // читать и записывать
+    Bypass,   // не трогать кэш
+    Refresh   // пересчитать и перезаписать
+};
+
+// Класс для работы с MongoDB
+class MongoDBHandler {
+private:
+    std::unique_ptr<StudentStore> store;
+    bsoncxx::builder::basic::document filter_;  // Фильтр как поле класса
+    StudentBatch batch_;  // столбцы для отчётов, переиспользуются между вызовами
+    std::vector<ReportSpec> reports_;  // отчёты, ждущие print_reports()
+    std::unique_ptr<ReportCache> cache;
+    CacheMode cache_mode = CacheMode::Bypass;
+    static const size_t batch_size = 1024;
+    std::chrono::milliseconds timeout_{10000};  // бюджет одного отчёта, 0 - без ограничения
+    std::shared_ptr<std::atomic<bool>> cancel_flag = std::make_shared<std::atomic<bool>>(false);
+
+    // Новый бюджет на каждый отчёт: дедлайн считается от начала запроса,
+    // отмена прошлого запроса на новый не распространяется
+    void start_budget() {
+        cancel_flag->store(false);
+        if (timeout_.count() > 0) {
+            store->set_budget(QueryBudget(timeout_, cancel_flag));
+        } else {
+            store->set_budget(QueryBudget(cancel_flag));
+        }
+    }
+
+    // Предупреждение о частичном результате; true, если запрос был прерван
+    bool warn_if_truncated() {
+        if (!store->truncated()) {
+            return false;
+        }
+        if (store->cancelled()) {
+            std::cout << "Внимание: запрос отменён, результат частичный." << std::endl;
+        } else {
+            std::cout << "Внимание: бюджет времени запроса (" << timeout_.count()
+                      << " мс) исчерпан, результат частичный." << std::endl;
+        }
+        return true;
+    }
+
+    // Отчёт через кэш: при попадании выводим сохранённый текст без обращения к хранилищу,
+    // иначе считаем отчёт и сохраняем его вывод. Прерванный по бюджету отчёт не кэшируется.
+    void cached(const std::string& request,
+                const std::vector<bsoncxx::document::view>& filters,
+                const std::function<void(std::ostream&)>& report) {
+        std::string source = store->cache_id();
+        if (!cache || cache_mode == CacheMode::Bypass || source.empty()) {
+            start_budget();
+            report(std::cout);
+            warn_if_truncated();
+            return;
+        }
+        uint64_t key = ReportCache::key(source, filters, request);
+        if (cache_mode == CacheMode::Use) {
+            if (auto text = cache->get(key)) {
+                std::cout << *text;
+                return;
+            }
+        }
+        std::ostringstream out;
+        start_budget();
+        report(out);
+        std::cout << out.str();
+        if (!warn_if_truncated()) {
+            cache->put(key, out.str());
+        }
+    }
 
 public:
     // Конструктор
     MongoDBHandler(const std::string& uri,
                    const std::string& db_name,
                    const std::string& coll_name)
-        : client{mongocxx::uri{uri}},
-          db{client[db_name]},
-          collection{db[coll_name]} {}
+        : store(std::make_unique<MongoStudentStore>(uri, db_name, coll_name)) {
+        batch_.reserve(batch_size);
+    }
+
+    // Конструктор с произвольным хранилищем (например, в памяти)
+    explicit MongoDBHandler(std::unique_ptr<StudentStore> store)
+        : store(std::move(store)) {
+        batch_.reserve(batch_size);
+    }
+
+    // Кэш отчётов на диске; mode управляет чтением и записью (см. CacheMode)
+    void enable_cache(const std::filesystem::path& dir,
+                      CacheMode mode,
+                      std::chrono::seconds ttl = std::chrono::seconds(300)) {
+        cache = std::make_unique<ReportCache>(dir, ttl);
+        cache_mode = mode;
+    }
+
+    // Бюджет времени на каждый отчёт; 0 - без ограничения
+    void set_timeout(std::chrono::milliseconds timeout) {
+        timeout_ = timeout;
+    }
+
+    // Отмена текущего запроса (можно вызывать из другого потока)
+    void cancel() {
+        cancel_flag->store(true);
+    }
 
-    // Метод для построения фильтра (дополняет фильтр новыми условиями)
+    // Добавляем условие в фильтр
     void build_filter(
         const std::string& field,
         const std::string& op,
         const bsoncxx::types::bson_value::value& value
     ) {
-        // Дополняем фильтр новыми условиями (не очищаем!)
         filter_.append(bsoncxx::builder::basic::kvp(
             field,
             bsoncxx::builder::basic::make_document(
@@ -40,82 +1093,158 @@ public:
         ));
     }
     
-    // Метод для очистки фильтра (если нужно начать заново)
+    // Очищаем фильтр
     void clear_filter() {
         filter_ = bsoncxx::builder::basic::document{};
     }
-// Выводим студентов
-    void print_average() {
-        auto cursor = collection.find(filter_.view());
 
-        double count = 0;
-        double totalAverage = 0.0;
+    // Выводим студентов
+    void print_average() {
+        AllocationScope allocations("MongoDBHandler::print_average");
+        cached("average", {filter_.view()}, [&](std::ostream& out) {
+            double count = 0;
+            double totalAverage = 0.0;
 
-        for (auto& doc : cursor) {
-            count+=1;
-            double avg = 0.0;
-            if (doc["Средний_балл"]) {
-                if (doc["Средний_балл"].type() == bsoncxx::type::k_double) {
-                    avg = doc["Средний_балл"].get_double().value;
-                } else {
-                    avg = static_cast<double>(doc["Средний_балл"].get_int32().value);
+            store->scan_batches(filter_.view(), batch_size, batch_, [&](const StudentBatch& batch) {
+                count += batch.size();
+                for (double avg : batch.grade_column()) {
+                    totalAverage += avg;
                 }
-            }
-            totalAverage += avg;
-        }
+            });
 
-        if (count > 0) {
-            double groupAverage = totalAverage / count;
-            std::cout << "Итого студентов: " << count
-                      << ", средний балл по выборке: "
-                      << std::fixed << std::setprecision(2) << groupAverage
-                      << std::defaultfloat
-                      << std::endl;
-        } else {
-            std::cout << "По заданному фильтру студентов не найдено." << std::endl;
-        }
+            if (count > 0) {
+                double groupAverage = totalAverage / count;
+                out << "Итого студентов: " << count
+                    << ", средний балл по выборке: "
+                    << std::fixed << std::setprecision(2) << groupAverage
+                    << std::defaultfloat
+                    << std::endl;
+            } else {
+                out << "По заданному фильтру студентов не найдено." << std::endl;
+            }
+        });
     }
 
 
     void print_max() {
-        // Метод выводящий максимальный средний балл студента в выборке
-        auto cursor = collection.find(filter_.view());
-
-        double maxAverage = 0.0;
-        int count = 0;
-        for (auto& doc : cursor) {
-            // Поиск максимального среднего балла
-            ++count;
-            double avg = 0.0;
-            if (doc["Средний_балл"]) {
-                if (doc["Средний_балл"].type() == bsoncxx::type::k_double) {
-                    avg = doc["Средний_балл"].get_double().value;
-                } else {
-                    avg = static_cast<double>(doc["Средний_балл"].get_int32().value);
+        AllocationScope allocations("MongoDBHandler::print_max");
+        cached("max", {filter_.view()}, [&](std::ostream& out) {
+            // Метод выводящий максимальный средний балл студента в выборке
+            double maxAverage = 0.0;
+            int count = 0;
+            store->scan_batches(filter_.view(), batch_size, batch_, [&](const StudentBatch& batch) {
+                // Поиск максимального среднего балла
+                count += static_cast<int>(batch.size());
+                for (double avg : batch.grade_column()) {
+                    if (avg > maxAverage) {
+                        maxAverage = avg;
+                    }
                 }
+            });
+
+            if (count > 0) {   
+                // Вывод максимального среднего балла
+                out << "Максимальный средний балл среди найденных студентов: "
+                    << std::fixed << std::setprecision(2) << maxAverage
+                    << std::defaultfloat
+                    << std::endl;
+            } else {
+                out << "По заданному фильтру студентов не найдено." << std::endl;
             }
-            if (avg > maxAverage) {
-                maxAverage = avg;
-            }
+        });
+    }
+
+    // Запоминаем текущий фильтр как именованный отчёт; statistic - "$avg", "$max", "$min" или "$sum"
+    void add_report(const std::string& name, const std::string& statistic) {
+        if (name.empty() || name[0] == '$' || name.find('.') != std::string::npos) {
+            throw std::invalid_argument("Недопустимое имя отчёта: " + name);
         }
+        if (statistic != "$avg" && statistic != "$max" && statistic != "$min" && statistic != "$sum") {
+            throw std::invalid_argument("Неизвестная статистика: " + statistic);
+        }
+        reports_.push_back({name, bsoncxx::document::value(filter_.view()), statistic});
+    }
 
-        if (count > 0) {   
-            // Вывод максимального среднего балла
-            std::cout << "Максимальный средний балл среди найденных студентов: "
-                      << std::fixed << std::setprecision(2) << maxAverage
-                      << std::defaultfloat
-                      << std::endl;
-        } else {
-            std::cout << "По заданному фильтру студентов не найдено." << std::endl;
+    // Выполняем все накопленные отчёты за один запрос и выводим их по именам
+    void print_reports() {
+        AllocationScope allocations("MongoDBHandler::print_reports");
+        if (reports_.empty()) {
+            return;
+        }
+        std::vector<bsoncxx::document::view> filters;
+        std::string request = "reports";
+        for (const auto& report : reports_) {
+            filters.push_back(report.filter.view());
+            request += ":" + report.name + "=" + report.statistic;
         }
+
+        cached(request, filters, [&](std::ostream& out) {
+            std::vector<ReportResult> results = store->run_reports(reports_);
+
+            for (const auto& result : results) {
+                out << "Студенты: " << result.name << std::endl;
+                if (result.count == 0) {
+                    out << "По заданному фильтру студентов не найдено." << std::endl;
+                    continue;
+                }
+                out << "Итого студентов: " << result.count << ", ";
+                if (result.statistic == "$avg") {
+                    out << "средний балл по выборке: ";
+                } else if (result.statistic == "$max") {
+                    out << "максимальный средний балл: ";
+                } else if (result.statistic == "$min") {
+                    out << "минимальный средний балл: ";
+                } else {
+                    out << "сумма средних баллов: ";
+                }
+                out << std::fixed << std::setprecision(2) << result.value
+                    << std::defaultfloat
+                    << std::endl;
+            }
+        });
+        reports_.clear();
     }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
     try {
-        MongoDBHandler handler("mongodb://localhost:27017", "university", "students");
+        // --no-cache: не использовать кэш отчётов, --refresh-cache: пересчитать и перезаписать его,
+        // --timeout MS: бюджет времени на отчёт (0 - без ограничения),
+        // --target URI DB COLL (можно несколько раз): отчёты сразу по всем указанным базам
+        CacheMode cache_mode = CacheMode::Use;
+        long long timeout_ms = 10000;
+        std::vector<std::array<std::string, 3>> targets;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--no-cache") {
+                cache_mode = CacheMode::Bypass;
+            } else if (arg == "--refresh-cache") {
+                cache_mode = CacheMode::Refresh;
+            } else if (arg == "--timeout" && i + 1 < argc) {
+                timeout_ms = std::stoll(argv[++i]);
+            } else if (arg == "--target" && i + 3 < argc) {
+                targets.push_back({argv[i + 1], argv[i + 2], argv[i + 3]});
+                i += 3;
+            } else {
+                std::cerr << "Неизвестный аргумент: " << arg << std::endl;
+                return 1;
+            }
+        }
 
-        std::cout << "Студенты: фамилия на 'А'" << std::endl;
+        mongocxx::instance instance{};
+        std::unique_ptr<StudentStore> store;
+        if (targets.empty()) {
+            store = std::make_unique<MongoStudentStore>("mongodb://localhost:27017", "university", "students");
+        } else {
+            auto fanout = std::make_unique<FanOutStudentStore>();
+            for (const auto& [uri, db_name, coll_name] : targets) {
+                fanout->add(std::make_unique<MongoStudentStore>(uri, db_name, coll_name));
+            }
+            store = std::move(fanout);
+        }
+        MongoDBHandler handler(std::move(store));
+        handler.enable_cache(".report_cache", cache_mode);
+        handler.set_timeout(std::chrono::milliseconds(timeout_ms));
 
         // Очищаем фильтр перед началом
         handler.clear_filter();
@@ -126,11 +1255,9 @@ int main() {
             "$regex",
             "^А"
         );
-
-        handler.print_average();
+        handler.add_report("фамилия на 'А'", "$avg");
         handler.clear_filter();
 
-        std::cout << "Студенты: средний балл < 70 и возраст < 19" << std::endl;
         // возраст < 19
         handler.build_filter(
             "Возраст",
@@ -143,7 +1270,11 @@ int main() {
             "$lt",
             70.0
         );
-        handler.print_max();
+        handler.add_report("средний балл < 70 и возраст < 19", "$max");
+
+        // Оба отчёта - одной агрегацией за один проход по коллекции
+        handler.print_reports();
+        AllocationScope::report(std::cerr);
     } catch (const std::exception& e) {
         std::cerr << "Ошибка: " << e.what() << std::endl;
     }
@@ -4,8 +4,213 @@
 #include <random>
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include <stdexcept>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <Eigen/Dense>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef TRACK_ALLOCATIONS
+#include <malloc.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <map>
+
+// Учёт выделений памяти (сборка с -DTRACK_ALLOCATIONS=ON).
+// Подменяем malloc/free glibc, а не только operator new: Eigen и libbson выделяют память
+// через malloc напрямую, а operator new в libstdc++ тоже сводится к malloc.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+struct AllocationCounters {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> frees{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> live{0};
+    std::atomic<int64_t> peak{0};
+};
+
+AllocationCounters allocation_counters;
+thread_local bool allocation_tracking_paused = false;
+
+inline void count_allocation(void* ptr) {
+    if (!ptr || allocation_tracking_paused) {
+        return;
+    }
+    size_t size = malloc_usable_size(ptr);
+    allocation_counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    allocation_counters.bytes.fetch_add(size, std::memory_order_relaxed);
+    int64_t live = allocation_counters.live.fetch_add(size, std::memory_order_relaxed) + size;
+    int64_t peak = allocation_counters.peak.load(std::memory_order_relaxed);
+    while (live > peak && !allocation_counters.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+inline void count_free(void* ptr) {
+    if (!ptr || allocation_tracking_paused) {
+        return;
+    }
+    allocation_counters.frees.fetch_add(1, std::memory_order_relaxed);
+    allocation_counters.live.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+}
+
+extern "C" {
+void* malloc(size_t size) noexcept {
+    void* ptr = __libc_malloc(size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+void* calloc(size_t count, size_t size) noexcept {
+    void* ptr = __libc_calloc(count, size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+// realloc считаем как освобождение старого блока и выделение нового
+void* realloc(void* old, size_t size) noexcept {
+    count_free(old);
+    void* ptr = __libc_realloc(old, size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+    void* ptr = __libc_memalign(alignment, size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) noexcept {
+    void* ptr = memalign(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+void free(void* ptr) noexcept {
+    count_free(ptr);
+    __libc_free(ptr);
+}
+}
+
+// Счётчики выделений на время жизни объекта; итоги копятся по имени области.
+// Счётчики общие для процесса: при работе нескольких потоков в область попадают и их выделения.
+class AllocationScope {
+private:
+    struct Totals {
+        uint64_t calls = 0;
+        uint64_t allocations = 0;
+        uint64_t frees = 0;
+        uint64_t bytes = 0;
+        int64_t peak_bytes = 0;  // наибольший прирост занятой памяти за один вызов
+    };
+
+    const char* name;
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t bytes;
+    int64_t live;
+    int64_t outer_peak;
+
+    static std::map<std::string, Totals>& totals() {
+        static std::map<std::string, Totals> registry;
+        return registry;
+    }
+
+public:
+    explicit AllocationScope(const char* name)
+        : name(name),
+          allocations(allocation_counters.allocations.load()),
+          frees(allocation_counters.frees.load()),
+          bytes(allocation_counters.bytes.load()),
+          live(allocation_counters.live.load()),
+          outer_peak(allocation_counters.peak.exchange(live)) {}
+
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+
+    ~AllocationScope() {
+        int64_t peak = allocation_counters.peak.load();
+        allocation_tracking_paused = true;
+        auto& entry = totals()[name];
+        ++entry.calls;
+        entry.allocations += allocation_counters.allocations.load() - allocations;
+        entry.frees += allocation_counters.frees.load() - frees;
+        entry.bytes += allocation_counters.bytes.load() - bytes;
+        entry.peak_bytes = std::max(entry.peak_bytes, peak - live);
+        allocation_tracking_paused = false;
+        // Пик внешней области не меньше пика вложенной
+        int64_t current = allocation_counters.peak.load();
+        while (current < outer_peak && !allocation_counters.peak.compare_exchange_weak(current, outer_peak)) {
+        }
+    }
+
+    // Итоги по областям, по строке JSON на область
+    static void report(std::ostream& out) {
+        allocation_tracking_paused = true;
+        for (const auto& [scope, entry] : totals()) {
+            out << "{\"scope\":\"" << scope << "\""
+                << ",\"calls\":" << entry.calls
+                << ",\"allocations\":" << entry.allocations
+                << ",\"frees\":" << entry.frees
+                << ",\"bytes\":" << entry.bytes
+                << ",\"peak_bytes\":" << entry.peak_bytes
+                << "}" << std::endl;
+        }
+        allocation_tracking_paused = false;
+    }
+};
+#else
+// Без TRACK_ALLOCATIONS области ничего не считают
+class AllocationScope {
+public:
+    explicit AllocationScope(const char*) {}
+
+    static void report(std::ostream&) {}
+};
+#endif
+
+// Сеть шаблонна по типу чисел: float вдвое шире по SIMD и вдвое легче по памяти, чем double
+template <typename Scalar>
+using Vector = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+template <typename Scalar>
+using Matrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+
+template <typename Scalar>
+using Array = Eigen::Array<Scalar, Eigen::Dynamic, 1>;
+
+template <typename Scalar>
 class ActivationFunction {
 protected:
     bool supports_hadamard_derivative;
@@ -14,191 +219,1376 @@ public:
     ActivationFunction(bool supports_hadamard = true) 
         : supports_hadamard_derivative(supports_hadamard) {}
     
-    virtual Eigen::VectorXd activate(const Eigen::VectorXd& x) = 0;
+    virtual Vector<Scalar> activate(const Vector<Scalar>& x) const = 0;
     
-    virtual Eigen::VectorXd derivative(const Eigen::VectorXd& x) = 0;
+    virtual Vector<Scalar> derivative(const Vector<Scalar>& x) const = 0;
     
-    virtual Eigen::MatrixXd jacobian(const Eigen::VectorXd& x) {
-        Eigen::VectorXd diag = derivative(x);
+    virtual Matrix<Scalar> jacobian(const Vector<Scalar>& x) const {
+        Vector<Scalar> diag = derivative(x);
         return diag.asDiagonal();
     }
+
+    // Пакетные версии: один столбец на пример. По умолчанию - по столбцам
+    virtual Matrix<Scalar> activate(const Matrix<Scalar>& x) const {
+        Matrix<Scalar> result(x.rows(), x.cols());
+        for (Eigen::Index j = 0; j < x.cols(); ++j) {
+            result.col(j) = activate(Vector<Scalar>(x.col(j)));
+        }
+        return result;
+    }
+
+    virtual Matrix<Scalar> derivative(const Matrix<Scalar>& x) const {
+        Matrix<Scalar> result(x.rows(), x.cols());
+        for (Eigen::Index j = 0; j < x.cols(); ++j) {
+            result.col(j) = derivative(Vector<Scalar>(x.col(j)));
+        }
+        return result;
+    }
+    
+    // Смещение и активация для слоя: out = f(wx + bias), bias добавляется к каждому столбцу.
+    // По умолчанию - через activate() с промежуточной матрицей z
+    virtual void forward(const Eigen::Ref<const Matrix<Scalar>>& wx,
+                         const Vector<Scalar>& bias,
+                         Eigen::Ref<Matrix<Scalar>> out) const {
+        Matrix<Scalar> z = wx.colwise() + bias;
+        out = activate(z);
+    }
+
+    // delta = dL/dz по градиенту dL/da. Производная выражается через сохранённый
+    // выход слоя a = f(z), чтобы не пересчитывать активацию в обратном проходе
+    virtual void backward(const Eigen::Ref<const Matrix<Scalar>>& output,
+                          const Eigen::Ref<const Matrix<Scalar>>& gradient,
+                          Eigen::Ref<Matrix<Scalar>> delta) const = 0;
     
     virtual ~ActivationFunction() = default;
     
     bool getSupportsHadamardDerivative() const {
         return supports_hadamard_derivative;
     }
-};
+};
+
+// Поэлементная активация со статической диспетчеризацией (CRTP): Derived задаёт
+// value(z) и slope(a) = f'(z), выраженную через выход a = f(z), как выражения Eigen. Смещение и активация считаются
+// одним выражением - без промежуточной z и без виртуальных вызовов внутри прохода.
+// Виртуальные activate/derivative остаются адаптером к общему интерфейсу.
+template <typename Derived, typename Scalar>
+class ElementwiseActivation : public ActivationFunction<Scalar> {
+public:
+    ElementwiseActivation() : ActivationFunction<Scalar>(true) {}
+
+    Vector<Scalar> activate(const Vector<Scalar>& x) const override {
+        return Derived::value(x.array());
+    }
+
+    Vector<Scalar> derivative(const Vector<Scalar>& x) const override {
+        Array<Scalar> a = Derived::value(x.array());
+        return Derived::slope(a);
+    }
+
+    Matrix<Scalar> activate(const Matrix<Scalar>& x) const override {
+        return Derived::value(x.array());
+    }
+
+    Matrix<Scalar> derivative(const Matrix<Scalar>& x) const override {
+        Eigen::Array<Scalar, Eigen::Dynamic, Eigen::Dynamic> a = Derived::value(x.array());
+        return Derived::slope(a);
+    }
+
+    void forward(const Eigen::Ref<const Matrix<Scalar>>& wx,
+                 const Vector<Scalar>& bias,
+                 Eigen::Ref<Matrix<Scalar>> out) const override {
+        out = Derived::value((wx.colwise() + bias).array()).matrix();
+    }
+
+    void backward(const Eigen::Ref<const Matrix<Scalar>>& output,
+                  const Eigen::Ref<const Matrix<Scalar>>& gradient,
+                  Eigen::Ref<Matrix<Scalar>> delta) const override {
+        delta = (gradient.array() * Derived::slope(output.array())).matrix();
+    }
+};
+
+template <typename Scalar>
+class Sigmoid : public ElementwiseActivation<Sigmoid<Scalar>, Scalar> {
+public:
+    template <typename Z>
+    static auto value(const Eigen::ArrayBase<Z>& z) {
+        return (Scalar(1) + (-z).exp()).inverse();
+    }
+
+    template <typename A>
+    static auto slope(const Eigen::ArrayBase<A>& a) {
+        return a * (Scalar(1) - a);
+    }
+};
+
+template <typename Scalar>
+class ReLU : public ElementwiseActivation<ReLU<Scalar>, Scalar> {
+public:
+    template <typename Z>
+    static auto value(const Eigen::ArrayBase<Z>& z) {
+        return z.max(Scalar(0));
+    }
+
+    template <typename A>
+    static auto slope(const Eigen::ArrayBase<A>& a) {
+        return (a > Scalar(0)).template cast<Scalar>();
+    }
+};
+
+template <typename Scalar>
+class Softmax : public ActivationFunction<Scalar> {
+public:
+    Softmax() : ActivationFunction<Scalar>(false) {}
+
+    using ActivationFunction<Scalar>::derivative;  // пакетная версия - по столбцам
+    
+        Vector<Scalar> activate(const Vector<Scalar>& x) const override {
+        Scalar max_val = x.maxCoeff();
+        Vector<Scalar> exp_x = (x.array() - max_val).exp();
+        Scalar sum = exp_x.sum();
+        return exp_x / sum;
+    }
+
+    Matrix<Scalar> activate(const Matrix<Scalar>& x) const override {
+        Matrix<Scalar> exp_x = (x.rowwise() - x.colwise().maxCoeff()).array().exp();
+        return exp_x.array().rowwise() / exp_x.colwise().sum().array();
+    }
+    
+    Vector<Scalar> derivative(const Vector<Scalar>& x) const override {
+        Vector<Scalar> s = activate(x);
+        return s.array() * (Scalar(1) - s.array());
+    }
+    
+    Matrix<Scalar> jacobian(const Vector<Scalar>& x) const override {
+        Vector<Scalar> s = activate(x);
+        Matrix<Scalar> diag_s = Matrix<Scalar>(s.asDiagonal());
+        return diag_s - s * s.transpose();
+    }
+
+    // Смещение и softmax на месте по столбцам, без промежуточной матрицы z
+    void forward(const Eigen::Ref<const Matrix<Scalar>>& wx,
+                 const Vector<Scalar>& bias,
+                 Eigen::Ref<Matrix<Scalar>> out) const override {
+        for (Eigen::Index j = 0; j < out.cols(); ++j) {
+            auto column = out.col(j);
+            column = wx.col(j) + bias;
+            Scalar max_val = column.maxCoeff();
+            column = (column.array() - max_val).exp().matrix();
+            column /= column.sum();
+        }
+    }
+
+    // (diag(s) - s s^T) g по столбцам через выход s, без построения якобиана
+    void backward(const Eigen::Ref<const Matrix<Scalar>>& output,
+                  const Eigen::Ref<const Matrix<Scalar>>& gradient,
+                  Eigen::Ref<Matrix<Scalar>> delta) const override {
+        for (Eigen::Index j = 0; j < output.cols(); ++j) {
+            Scalar sg = output.col(j).dot(gradient.col(j));
+            delta.col(j) = (output.col(j).array() * (gradient.col(j).array() - sg)).matrix();
+        }
+    }
+};
+
+template <typename Scalar>
+class LossFunction {
+public:
+    virtual Scalar loss(const Vector<Scalar>& predicted, const Vector<Scalar>& target) = 0;
+
+    virtual Vector<Scalar> derivative(const Vector<Scalar>& predicted, const Vector<Scalar>& target) = 0;
+
+    // Умеет ли функция сразу дать градиент по входу Softmax (без якобиана)
+    virtual bool fusesWithSoftmax() const {
+        return false;
+    }
+
+    // Градиент по z выходного слоя Softmax; вызывается, только если fusesWithSoftmax()
+    virtual Matrix<Scalar> softmaxDelta(const Matrix<Scalar>&, const Matrix<Scalar>&) {
+        throw std::logic_error("Функция потерь не объединяется с Softmax");
+    }
+
+    // Сумма потерь по примерам пакета (столбцам)
+    virtual Scalar loss(const Matrix<Scalar>& predicted, const Matrix<Scalar>& target) {
+        Scalar total = 0.0;
+        for (Eigen::Index j = 0; j < predicted.cols(); ++j) {
+            total += loss(Vector<Scalar>(predicted.col(j)), Vector<Scalar>(target.col(j)));
+        }
+        return total;
+    }
+
+    // Градиент по каждому примеру пакета, без усреднения
+    virtual Matrix<Scalar> derivative(const Matrix<Scalar>& predicted, const Matrix<Scalar>& target) {
+        Matrix<Scalar> result(predicted.rows(), predicted.cols());
+        for (Eigen::Index j = 0; j < predicted.cols(); ++j) {
+            result.col(j) = derivative(Vector<Scalar>(predicted.col(j)), Vector<Scalar>(target.col(j)));
+        }
+        return result;
+    }
+    
+    virtual ~LossFunction() = default;
+};
+
+// Mean Squared Error (MSE)
+template <typename Scalar>
+class MSE : public LossFunction<Scalar> {
+public:
+    Scalar loss(const Vector<Scalar>& predicted, const Vector<Scalar>& target) override {
+        Vector<Scalar> diff = predicted - target;
+        return diff.squaredNorm() / Scalar(predicted.size());
+    }
+    
+    Vector<Scalar> derivative(const Vector<Scalar>& predicted, const Vector<Scalar>& target) override {
+        return Scalar(2) * (predicted - target) / Scalar(predicted.size());
+    }
+
+    Scalar loss(const Matrix<Scalar>& predicted, const Matrix<Scalar>& target) override {
+        return (predicted - target).squaredNorm() / Scalar(predicted.rows());
+    }
+
+    Matrix<Scalar> derivative(const Matrix<Scalar>& predicted, const Matrix<Scalar>& target) override {
+        return Scalar(2) * (predicted - target) / Scalar(predicted.rows());
+    }
+};
+
+// Перекрёстная энтропия для one-hot целей. В паре с Softmax градиент по z равен p - y:
+// O(n) вместо умножения на якобиан n x n
+template <typename Scalar>
+class CrossEntropy : public LossFunction<Scalar> {
+private:
+    static constexpr Scalar epsilon = Scalar(1e-12);  // защита от log(0)
+
+public:
+    Scalar loss(const Vector<Scalar>& predicted, const Vector<Scalar>& target) override {
+        return -(target.array() * (predicted.array() + epsilon).log()).sum();
+    }
+
+    Vector<Scalar> derivative(const Vector<Scalar>& predicted, const Vector<Scalar>& target) override {
+        return -(target.array() / (predicted.array() + epsilon));
+    }
+
+    Scalar loss(const Matrix<Scalar>& predicted, const Matrix<Scalar>& target) override {
+        return -(target.array() * (predicted.array() + epsilon).log()).sum();
+    }
+
+    Matrix<Scalar> derivative(const Matrix<Scalar>& predicted, const Matrix<Scalar>& target) override {
+        return -(target.array() / (predicted.array() + epsilon));
+    }
+
+    bool fusesWithSoftmax() const override {
+        return true;
+    }
+
+    Matrix<Scalar> softmaxDelta(const Matrix<Scalar>& predicted, const Matrix<Scalar>& target) override {
+        return predicted - target;
+    }
+};
+
+// Подсказка оптимизатору: градиент весов (по столбцам, rows строк) отличен от нуля
+// только в перечисленных столбцах. Остальные элементы буфера градиента - нули
+struct SparseGradient {
+    bool active = false;
+    Eigen::Index rows = 0;
+    std::vector<Eigen::Index> columns;
+};
+
+// Разреженный вход пакета: ненулевые элементы по столбцам (offsets[j]..offsets[j + 1]).
+// binary - все ненулевые равны 1, тогда умножение на вход сводится к сумме столбцов весов
+template <typename Scalar>
+struct SparseColumns {
+    std::vector<Eigen::Index> offsets;
+    std::vector<Eigen::Index> indices;
+    std::vector<Scalar> values;
+    bool binary = true;
+
+    // Собирает структуру, если доля ненулевых не больше max_density; иначе false.
+    // Буферы переиспользуются между вызовами
+    bool build(const Eigen::Ref<const Matrix<Scalar>>& input, double max_density) {
+        const size_t limit = static_cast<size_t>(max_density * input.size());
+        offsets.clear();
+        indices.clear();
+        values.clear();
+        binary = true;
+        offsets.push_back(0);
+        for (Eigen::Index j = 0; j < input.cols(); ++j) {
+            for (Eigen::Index i = 0; i < input.rows(); ++i) {
+                Scalar value = input(i, j);
+                if (value != Scalar(0)) {
+                    if (indices.size() == limit) {
+                        return false;
+                    }
+                    indices.push_back(i);
+                    values.push_back(value);
+                    binary = binary && value == Scalar(1);
+                }
+            }
+            offsets.push_back(static_cast<Eigen::Index>(indices.size()));
+        }
+        return true;
+    }
+
+    // out = weights * вход: сумма столбцов весов по ненулевым элементам
+    void multiply(const Matrix<Scalar>& weights, Eigen::Ref<Matrix<Scalar>> out) const {
+        out.setZero();
+        for (Eigen::Index j = 0; j + 1 < static_cast<Eigen::Index>(offsets.size()); ++j) {
+            auto column = out.col(j);
+            for (Eigen::Index k = offsets[j]; k < offsets[j + 1]; ++k) {
+                if (binary) {
+                    column += weights.col(indices[k]);
+                } else {
+                    column += values[k] * weights.col(indices[k]);
+                }
+            }
+        }
+    }
+
+    // target += scale * delta * вход^T: меняются только столбцы ненулевых элементов
+    void add_outer(const Eigen::Ref<const Matrix<Scalar>>& delta, Scalar scale, Eigen::Ref<Matrix<Scalar>> target) const {
+        for (Eigen::Index j = 0; j < delta.cols(); ++j) {
+            for (Eigen::Index k = offsets[j]; k < offsets[j + 1]; ++k) {
+                target.col(indices[k]) += (scale * values[k]) * delta.col(j);
+            }
+        }
+    }
+};
+
+// Параметр сети для оптимизатора: значения и градиент как плоские массивы
+template <typename Scalar>
+struct Parameter {
+    Scalar* value;
+    const Scalar* gradient;
+    Eigen::Index size;
+    const SparseGradient* sparse = nullptr;  // только у весов слоя с разреженным входом
+};
+
+// Правило обновления параметров по градиентам из буферов слоёв.
+// Состояние (скорости, моменты) выделяется один раз в attach().
+template <typename Scalar>
+class Optimizer {
+public:
+    virtual void attach(const std::vector<Parameter<Scalar>>&) {}
+
+    virtual void step(const std::vector<Parameter<Scalar>>& parameters, Scalar learning_rate) = 0;
+
+    virtual ~Optimizer() = default;
+};
+
+template <typename Scalar>
+class SGD : public Optimizer<Scalar> {
+public:
+    void step(const std::vector<Parameter<Scalar>>& parameters, Scalar learning_rate) override {
+        for (const auto& p : parameters) {
+            if (p.sparse && p.sparse->active) {
+                // Вне перечисленных столбцов градиент нулевой - их не трогаем
+                for (Eigen::Index column : p.sparse->columns) {
+                    Eigen::Index offset = column * p.sparse->rows;
+                    Eigen::Map<Array<Scalar>> value(p.value + offset, p.sparse->rows);
+                    Eigen::Map<const Array<Scalar>> gradient(p.gradient + offset, p.sparse->rows);
+                    value -= learning_rate * gradient;
+                }
+                continue;
+            }
+            Eigen::Map<Array<Scalar>> value(p.value, p.size);
+            Eigen::Map<const Array<Scalar>> gradient(p.gradient, p.size);
+            value -= learning_rate * gradient;
+        }
+    }
+};
+
+// SGD с моментом: v = beta * v + g, w -= lr * v
+template <typename Scalar>
+class Momentum : public Optimizer<Scalar> {
+private:
+    Scalar beta;
+    std::vector<Array<Scalar>> velocity;
+
+public:
+    Momentum(Scalar beta = 0.9) : beta(beta) {}
+
+    void attach(const std::vector<Parameter<Scalar>>& parameters) override {
+        velocity.clear();
+        for (const auto& p : parameters) {
+            velocity.push_back(Array<Scalar>::Zero(p.size));
+        }
+    }
+
+    void step(const std::vector<Parameter<Scalar>>& parameters, Scalar learning_rate) override {
+        for (size_t i = 0; i < parameters.size(); ++i) {
+            Eigen::Map<Array<Scalar>> value(parameters[i].value, parameters[i].size);
+            Eigen::Map<const Array<Scalar>> gradient(parameters[i].gradient, parameters[i].size);
+            velocity[i] = beta * velocity[i] + gradient;
+            value -= learning_rate * velocity[i];
+        }
+    }
+};
+
+// Adam: скользящие средние градиента и его квадрата с поправкой на смещение
+template <typename Scalar>
+class Adam : public Optimizer<Scalar> {
+private:
+    Scalar beta1;
+    Scalar beta2;
+    Scalar epsilon;
+    long long t = 0;
+    std::vector<Array<Scalar>> m;
+    std::vector<Array<Scalar>> v;
+
+public:
+    Adam(Scalar beta1 = 0.9, Scalar beta2 = 0.999, Scalar epsilon = 1e-8)
+        : beta1(beta1), beta2(beta2), epsilon(epsilon) {}
+
+    void attach(const std::vector<Parameter<Scalar>>& parameters) override {
+        m.clear();
+        v.clear();
+        t = 0;
+        for (const auto& p : parameters) {
+            m.push_back(Array<Scalar>::Zero(p.size));
+            v.push_back(Array<Scalar>::Zero(p.size));
+        }
+    }
+
+    void step(const std::vector<Parameter<Scalar>>& parameters, Scalar learning_rate) override {
+        ++t;
+        Scalar correction1 = Scalar(1) - std::pow(beta1, Scalar(t));
+        Scalar correction2 = Scalar(1) - std::pow(beta2, Scalar(t));
+        for (size_t i = 0; i < parameters.size(); ++i) {
+            Eigen::Map<Array<Scalar>> value(parameters[i].value, parameters[i].size);
+            Eigen::Map<const Array<Scalar>> gradient(parameters[i].gradient, parameters[i].size);
+            m[i] = beta1 * m[i] + (Scalar(1) - beta1) * gradient;
+            v[i] = beta2 * v[i] + (Scalar(1) - beta2) * gradient.square();
+            value -= learning_rate * (m[i] / correction1) / ((v[i] / correction2).sqrt() + epsilon);
+        }
+    }
+};
+
+template <typename Scalar>
+class Layer {
+protected:
+    Matrix<Scalar> weights;
+    Vector<Scalar> biases;
+    Vector<Scalar> last_output;  // Выход активации: по нему backward считает производную
+    Vector<Scalar> last_input;  // Сохраняем input для backward
+    Matrix<Scalar> last_output_batch;  // То же для пакета: столбец на пример
+    Matrix<Scalar> last_input_batch;
+    Matrix<Scalar> weight_gradient;  // Градиенты последнего backward, их применяет оптимизатор
+    Vector<Scalar> bias_gradient;
+
+    // Разреженный вход (пиксели 0/1 первого слоя): forward суммирует столбцы весов
+    // по ненулевым входам, backward пишет градиент только в эти столбцы
+    double sparse_max_density = 0.0;  // 0 - всегда плотный путь
+    SparseColumns<Scalar> sparse_input;  // вход последнего forward, если он разреженный
+    bool sparse_active = false;
+    SparseGradient weight_sparsity;  // какие столбцы weight_gradient ненулевые
+    std::vector<char> column_seen;
+    bool input_gradient_needed = false;  // перед слоем в сети есть другие слои
+
+    // Градиент весов по разреженному входу. Ненулевые столбцы прошлого шага обнуляются
+    // поштучно (или весь буфер после плотного шага), остальные уже нули
+    void sparse_weight_gradient(const Eigen::Ref<const Matrix<Scalar>>& delta, Scalar scale) {
+        if (weight_sparsity.active) {
+            for (Eigen::Index column : weight_sparsity.columns) {
+                weight_gradient.col(column).setZero();
+            }
+        } else {
+            weight_gradient.setZero();
+        }
+        sparse_input.add_outer(delta, scale, weight_gradient);
+
+        weight_sparsity.columns.clear();
+        column_seen.resize(input_size, 0);
+        for (Eigen::Index column : sparse_input.indices) {
+            if (!column_seen[column]) {
+                column_seen[column] = 1;
+                weight_sparsity.columns.push_back(column);
+            }
+        }
+        for (Eigen::Index column : weight_sparsity.columns) {
+            column_seen[column] = 0;
+        }
+        weight_sparsity.active = true;
+    }
+    
+public:
+    int input_size;
+    int output_size;
+    ActivationFunction<Scalar>& activation;
+    
+    Layer(int input_size, int output_size, ActivationFunction<Scalar>& activation)
+        : input_size(input_size), output_size(output_size), activation(activation),
+          weights(output_size, input_size), biases(output_size) {
+        // Xavier initialization
+        double limit = std::sqrt(6.0 / (input_size + output_size));
+        // Случайные веса генерируются в double: float и double модели стартуют одинаково
+        weights = (Eigen::MatrixXd::Random(output_size, input_size) * limit).cast<Scalar>();        
+        biases.setZero();
+        weight_gradient = Matrix<Scalar>::Zero(output_size, input_size);
+        bias_gradient = Vector<Scalar>::Zero(output_size);
+        weight_sparsity.rows = output_size;
+    }
+
+    // Включить разреженный путь для входов, где ненулевых не больше max_density.
+    // Только для первого слоя: градиент по входу тогда не считается
+    void enableSparseInput(double max_density = 0.25) {
+        if (input_gradient_needed) {
+            throw std::logic_error("Разреженный вход возможен только у первого слоя сети");
+        }
+        sparse_max_density = max_density;
+    }
+
+    // Сеть сообщает слою, что перед ним есть другие слои и им нужен градиент по входу
+    void requireInputGradient() {
+        if (sparse_max_density > 0) {
+            throw std::logic_error("Разреженный вход возможен только у первого слоя сети");
+        }
+        input_gradient_needed = true;
+    }
+
+    const Matrix<Scalar>& getWeights() const {
+        return weights;
+    }
+
+    const Vector<Scalar>& getBiases() const {
+        return biases;
+    }
+
+    // Веса и смещения вместе с их градиентами - для оптимизатора
+    void parameters(std::vector<Parameter<Scalar>>& out) {
+        out.push_back({weights.data(), weight_gradient.data(), weights.size(), &weight_sparsity});
+        out.push_back({biases.data(), bias_gradient.data(), biases.size()});
+    }
+    
+    // z = wx + bias не хранится: wx пишется в буфер выхода, смещение и активация
+    // применяются к нему на месте, а backward берёт производную по выходу
+    Vector<Scalar> forward(const Vector<Scalar>& input) {
+        sparse_active = sparse_max_density > 0 && sparse_input.build(input, sparse_max_density);
+        if (sparse_active) {
+            last_output.resize(output_size);
+            sparse_input.multiply(weights, last_output);
+        } else {
+            last_input = input; 
+            last_output.noalias() = weights * input;
+        }
+        activation.forward(last_output, biases, last_output);
+        return last_output;
+    }
+    
+    // Считаем градиенты в буферы слоя; веса не меняются до шага оптимизатора
+    Vector<Scalar> backward(const Vector<Scalar>& gradient) {
+        Vector<Scalar> delta(output_size);
+        activation.backward(last_output, gradient, delta);
+        return backward_delta(delta);
+    }
+
+    // Обратный проход, когда градиент по z (delta) уже известен - например,
+    // от функции потерь, объединённой с активацией слоя
+    Vector<Scalar> backward_delta(const Vector<Scalar>& delta) {
+        if (sparse_active) {
+            sparse_weight_gradient(delta, Scalar(1));
+            bias_gradient = delta;
+            return Vector<Scalar>();  // слой первый, градиент по входу не нужен
+        }
+        weight_sparsity.active = false;
+        weight_gradient.noalias() = delta * last_input.transpose();
+        bias_gradient = delta;
+        
+        // Градиент для предыдущего слоя
+        return weights.transpose() * delta; 
+    }
+
+    // Прямой проход по пакету: одно умножение матриц вместо умножения на вектор для каждого примера
+    Matrix<Scalar> forward(const Matrix<Scalar>& input) {
+        sparse_active = sparse_max_density > 0 && sparse_input.build(input, sparse_max_density);
+        if (sparse_active) {
+            last_output_batch.resize(output_size, input.cols());
+            sparse_input.multiply(weights, last_output_batch);
+        } else {
+            last_input_batch = input;
+            last_output_batch.noalias() = weights * input;
+        }
+        activation.forward(last_output_batch, biases, last_output_batch);
+        return last_output_batch;
+    }
+
+    // Обратный проход по пакету; градиент весов усредняется по примерам
+    Matrix<Scalar> backward(const Matrix<Scalar>& gradient) {
+        Matrix<Scalar> delta(gradient.rows(), gradient.cols());
+        activation.backward(last_output_batch, gradient, delta);
+        return backward_delta(delta);
+    }
+
+    Matrix<Scalar> backward_delta(const Matrix<Scalar>& delta) {
+        Scalar scale = Scalar(1) / Scalar(delta.cols());
+        if (sparse_active) {
+            sparse_weight_gradient(delta, scale);
+            bias_gradient = scale * delta.rowwise().sum();
+            return Matrix<Scalar>();
+        }
+        weight_sparsity.active = false;
+        weight_gradient.noalias() = scale * delta * last_input_batch.transpose();
+        bias_gradient = scale * delta.rowwise().sum();
+
+        return weights.transpose() * delta;
+    }
+
+    // Рабочая память одного потока при параллельном обучении: входы, выходы и градиенты
+    // слоя для своей части пакета. Веса в этих проходах только читаются
+    struct Workspace {
+        Matrix<Scalar> input;
+        Matrix<Scalar> output;
+        Matrix<Scalar> delta;
+        Matrix<Scalar> weight_gradient;  // сумма по примерам части, без усреднения
+        Vector<Scalar> bias_gradient;
+        SparseColumns<Scalar> sparse;
+        bool sparse_active = false;
+    };
+
+    const Matrix<Scalar>& forward(const Eigen::Ref<const Matrix<Scalar>>& input, Workspace& ws) const {
+        ws.sparse_active = sparse_max_density > 0 && ws.sparse.build(input, sparse_max_density);
+        if (ws.sparse_active) {
+            ws.output.resize(output_size, input.cols());
+            ws.sparse.multiply(weights, ws.output);
+            activation.forward(ws.output, biases, ws.output);
+            return ws.output;
+        }
+        ws.input = input;
+        ws.output.noalias() = weights * input;
+        activation.forward(ws.output, biases, ws.output);
+        return ws.output;
+    }
+
+    Matrix<Scalar> backward(const Matrix<Scalar>& gradient, Workspace& ws) const {
+        ws.delta.resize(gradient.rows(), gradient.cols());
+        activation.backward(ws.output, gradient, ws.delta);
+        return backward_delta(ws.delta, ws);
+    }
+
+    Matrix<Scalar> backward_delta(const Matrix<Scalar>& delta, Workspace& ws) const {
+        ws.bias_gradient = delta.rowwise().sum();
+        if (ws.sparse_active) {
+            // Свёртка частей плотная, поэтому буфер части заполняется целиком
+            ws.weight_gradient.setZero(output_size, input_size);
+            ws.sparse.add_outer(delta, Scalar(1), ws.weight_gradient);
+            return Matrix<Scalar>();
+        }
+        ws.weight_gradient.noalias() = delta * ws.input.transpose();
+
+        return weights.transpose() * delta;
+    }
+
+    // Градиент пакета = scale * сумма градиентов частей. Части складываются всегда
+    // в одном порядке, поэтому результат не зависит от того, какой поток закончил первым.
+    // Сворачиваются строки [begin, begin + count), чтобы свёртку можно было разделить
+    void reduce_gradients(const std::vector<const Workspace*>& parts, Scalar scale,
+                          Eigen::Index begin, Eigen::Index count) {
+        if (begin == 0) {
+            // Свёрнутый градиент плотный; флаг пишет один поток - тот, чья полоса первая
+            weight_sparsity.active = false;
+        }
+        auto weight = weight_gradient.middleRows(begin, count);
+        auto bias = bias_gradient.segment(begin, count);
+        weight = parts[0]->weight_gradient.middleRows(begin, count);
+        bias = parts[0]->bias_gradient.segment(begin, count);
+        for (size_t i = 1; i < parts.size(); ++i) {
+            weight += parts[i]->weight_gradient.middleRows(begin, count);
+            bias += parts[i]->bias_gradient.segment(begin, count);
+        }
+        weight *= scale;
+        bias *= scale;
+    }
+
+    // delta слоя по градиенту выхода; результат остаётся в ws.delta
+    const Matrix<Scalar>& delta(const Matrix<Scalar>& gradient, Workspace& ws) const {
+        ws.delta.resize(gradient.rows(), gradient.cols());
+        activation.backward(ws.output, gradient, ws.delta);
+        return ws.delta;
+    }
+
+    // Шаг SGD без блокировок для Hogwild: градиент для предыдущего слоя берётся по весам
+    // до обновления, затем веса меняются на месте, минуя буферы градиентов и оптимизатор
+    Matrix<Scalar> step_unsynchronized(const Matrix<Scalar>& delta, const Workspace& ws, Scalar learning_rate) {
+        Scalar scale = learning_rate / Scalar(delta.cols());
+        if (ws.sparse_active) {
+            // Обновляются только столбцы активных входов
+            ws.sparse.add_outer(delta, -scale, weights);
+            biases.noalias() -= scale * delta.rowwise().sum();
+            return Matrix<Scalar>();
+        }
+        Matrix<Scalar> upstream = weights.transpose() * delta;
+        weights.noalias() -= scale * delta * ws.input.transpose();
+        biases.noalias() -= scale * delta.rowwise().sum();
+        return upstream;
+    }
+};
+
+template <typename Scalar>
+class DataParallelTrainer;
+
+template <typename Scalar>
+class HogwildTrainer;
+
+template <typename Scalar>
+class InferenceEngine;
+
+template <typename Scalar>
+class QuantizedNetwork;
+
+template <typename Scalar>
+class NeuralNetwork {
+private:
+    std::vector<Layer<Scalar>*> layers;
+    LossFunction<Scalar>* loss_function;
+    SGD<Scalar> default_optimizer;
+    Optimizer<Scalar>* optimizer = &default_optimizer;
+    std::vector<Parameter<Scalar>> parameters;
+    bool attached = false;  // состояние оптимизатора выделено под текущие слои
+
+    friend class DataParallelTrainer<Scalar>;
+    friend class HogwildTrainer<Scalar>;
+    friend class InferenceEngine<Scalar>;
+    friend class QuantizedNetwork<Scalar>;
+
+    // Выходной слой Softmax и функция потерь дают градиент по z сразу
+    bool fused_output() const {
+        return !layers.empty() && loss_function->fusesWithSoftmax() &&
+               dynamic_cast<Softmax<Scalar>*>(&layers.back()->activation) != nullptr;
+    }
+
+    // Шаг оптимизатора по градиентам, посчитанным backward
+    void apply_gradients(Scalar learning_rate) {
+        if (!attached) {
+            optimizer->attach(parameters);
+            attached = true;
+        }
+        optimizer->step(parameters, learning_rate);
+    }
+    
+public:
+    NeuralNetwork(LossFunction<Scalar>* loss) : loss_function(loss) {}
+    
+    ~NeuralNetwork() {
+        for (auto* layer : layers) {
+            delete layer;
+        }
+    }
+    
+    void addLayer(Layer<Scalar>* layer) {
+        if (!layers.empty()) {
+            layer->requireInputGradient();
+        }
+        layers.push_back(layer);
+        layer->parameters(parameters);
+        attached = false;
+    }
+
+    // Оптимизатор не принадлежит сети (как и функция потерь); по умолчанию - SGD
+    void setOptimizer(Optimizer<Scalar>* next) {
+        optimizer = next;
+        attached = false;
+    }
+    
+    Vector<Scalar> forward(const Vector<Scalar>& input) {
+        Vector<Scalar> x = input;
+        for (auto* layer : layers) {
+            x = layer->forward(x);
+        }
+        return x;
+    }
+    
+    Scalar train(const Vector<Scalar>& input, const Vector<Scalar>& target, Scalar learning_rate = Scalar(0.01)) {
+        AllocationScope allocations("NeuralNetwork::train");
+        // Forward pass
+        Vector<Scalar> output = forward(input);
+        
+        // Вычисляем loss
+        Scalar loss_val = loss_function->loss(output, target);
+        
+        // Backward pass
+        auto it = layers.rbegin();
+        Vector<Scalar> gradient;
+        if (fused_output()) {
+            gradient = (*it++)->backward_delta(Vector<Scalar>(loss_function->softmaxDelta(output, target)));
+        } else {
+            gradient = loss_function->derivative(output, target);
+        }
+        for (; it != layers.rend(); ++it) {
+            gradient = (*it)->backward(gradient);
+        }
+        apply_gradients(learning_rate);
+        
+        return loss_val;
+    }
+    
+    // Шаг по пакету (столбец на пример); возвращает сумму потерь по пакету
+    Scalar train(const Matrix<Scalar>& inputs, const Matrix<Scalar>& targets, Scalar learning_rate = Scalar(0.01)) {
+        AllocationScope allocations("NeuralNetwork::train_batch");
+        Matrix<Scalar> output = inputs;
+        for (auto* layer : layers) {
+            output = layer->forward(output);
+        }
+
+        Scalar loss_val = loss_function->loss(output, targets);
+
+        auto it = layers.rbegin();
+        Matrix<Scalar> gradient;
+        if (fused_output()) {
+            gradient = (*it++)->backward_delta(loss_function->softmaxDelta(output, targets));
+        } else {
+            gradient = loss_function->derivative(output, targets);
+        }
+        for (; it != layers.rend(); ++it) {
+            gradient = (*it)->backward(gradient);
+        }
+        apply_gradients(learning_rate);
+
+        return loss_val;
+    }
+
+    // Эпоха по пакетам из batch_size столбцов; возвращает сумму потерь по всем примерам
+    Scalar train_epoch(const Matrix<Scalar>& inputs,
+                       const Matrix<Scalar>& targets,
+                       int batch_size,
+                       Scalar learning_rate = Scalar(0.01)) {
+        Scalar total_loss = 0.0;
+        for (Eigen::Index start = 0; start < inputs.cols(); start += batch_size) {
+            Eigen::Index count = std::min<Eigen::Index>(batch_size, inputs.cols() - start);
+            total_loss += train(Matrix<Scalar>(inputs.middleCols(start, count)),
+                                Matrix<Scalar>(targets.middleCols(start, count)),
+                                learning_rate);
+        }
+        return total_loss;
+    }
+
+    Vector<Scalar> predict(const Vector<Scalar>& input) {
+        AllocationScope allocations("NeuralNetwork::predict");
+        return forward(input);
+    }
+};
+
+// Постоянные потоки для параллельных шагов обучения: run(task) вызывает task(i)
+// в каждом потоке пула и ждёт, пока закончат все. Поток 0 - вызывающий
+class WorkerPool {
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    std::function<void(int)> task;
+    long long generation = 0;
+    int pending = 0;
+    bool stopping = false;
+
+    void loop(int index) {
+        long long seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start_cv.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+            }
+            task(index);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--pending == 0) {
+                    done_cv.notify_one();
+                }
+            }
+        }
+    }
+
+public:
+    explicit WorkerPool(int size) {
+        for (int i = 1; i < size; ++i) {
+            threads.emplace_back(&WorkerPool::loop, this, i);
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start_cv.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    int size() const {
+        return static_cast<int>(threads.size()) + 1;
+    }
+
+    void run(std::function<void(int)> next) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = std::move(next);
+            pending = static_cast<int>(threads.size());
+            ++generation;
+        }
+        start_cv.notify_all();
+        task(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&] { return pending == 0; });
+    }
+};
+
+// Параллельное по данным обучение: пакет делится на непрерывные части по числу потоков,
+// каждый поток считает прямой и обратный проход своей части в своей рабочей памяти,
+// затем градиенты сворачиваются в буферы слоёв и сеть делает обычный шаг оптимизатора.
+// Часть i всегда считает поток i, а свёртка идёт в порядке частей - при одинаковом
+// числе потоков результат воспроизводим от запуска к запуску
+template <typename Scalar>
+class DataParallelTrainer {
+private:
+    using Workspace = typename Layer<Scalar>::Workspace;
+
+    NeuralNetwork<Scalar>& network;
+    WorkerPool pool;
+    std::vector<std::vector<Workspace>> workspaces;  // [поток][слой]
+    std::vector<std::vector<const Workspace*>> parts_by_layer;
+    std::vector<Scalar> losses;
+
+    // Прямой и обратный проход части пакета; возвращает сумму потерь части
+    Scalar train_part(std::vector<Workspace>& ws,
+                      const Eigen::Ref<const Matrix<Scalar>>& inputs,
+                      const Matrix<Scalar>& targets) {
+        const auto& layers = network.layers;
+        const Matrix<Scalar>* output = &layers[0]->forward(inputs, ws[0]);
+        for (size_t l = 1; l < layers.size(); ++l) {
+            output = &layers[l]->forward(*output, ws[l]);
+        }
+
+        Scalar loss_val = network.loss_function->loss(*output, targets);
+
+        size_t l = layers.size() - 1;
+        Matrix<Scalar> gradient;
+        if (network.fused_output()) {
+            gradient = layers[l]->backward_delta(network.loss_function->softmaxDelta(*output, targets), ws[l]);
+        } else {
+            gradient = layers[l]->backward(network.loss_function->derivative(*output, targets), ws[l]);
+        }
+        while (l-- > 0) {
+            gradient = layers[l]->backward(gradient, ws[l]);
+        }
+        return loss_val;
+    }
+
+public:
+    DataParallelTrainer(NeuralNetwork<Scalar>& network, int threads)
+        : network(network), pool(std::max(threads, 1)), workspaces(pool.size()), losses(pool.size()) {}
+
+    int threads() const {
+        return pool.size();
+    }
+
+    // Шаг по пакету (столбец на пример); возвращает сумму потерь по пакету
+    Scalar train(const Matrix<Scalar>& inputs, const Matrix<Scalar>& targets, Scalar learning_rate = Scalar(0.01)) {
+        AllocationScope allocations("DataParallelTrainer::train");
+        const auto& layers = network.layers;
+        const Eigen::Index columns = inputs.cols();
+        const int parts = static_cast<int>(std::min<Eigen::Index>(pool.size(), columns));
+        for (auto& ws : workspaces) {
+            ws.resize(layers.size());
+        }
+
+        pool.run([&](int worker) {
+            if (worker >= parts) {
+                return;
+            }
+            Eigen::Index begin = columns * worker / parts;
+            Eigen::Index count = columns * (worker + 1) / parts - begin;
+            losses[worker] = train_part(workspaces[worker],
+                                        inputs.middleCols(begin, count),
+                                        Matrix<Scalar>(targets.middleCols(begin, count)));
+        });
+
+        parts_by_layer.resize(layers.size());
+        for (size_t l = 0; l < layers.size(); ++l) {
+            parts_by_layer[l].clear();
+            for (int i = 0; i < parts; ++i) {
+                parts_by_layer[l].push_back(&workspaces[i][l]);
+            }
+        }
+
+        // Свёртку тоже делим: каждый поток складывает свою полосу строк каждого слоя
+        const Scalar scale = Scalar(1) / Scalar(columns);
+        pool.run([&](int worker) {
+            for (size_t l = 0; l < layers.size(); ++l) {
+                Eigen::Index rows = layers[l]->output_size;
+                Eigen::Index begin = rows * worker / pool.size();
+                Eigen::Index count = rows * (worker + 1) / pool.size() - begin;
+                if (count > 0) {
+                    layers[l]->reduce_gradients(parts_by_layer[l], scale, begin, count);
+                }
+            }
+        });
+        network.apply_gradients(learning_rate);
+
+        Scalar total_loss = 0;
+        for (int i = 0; i < parts; ++i) {
+            total_loss += losses[i];
+        }
+        return total_loss;
+    }
+
+    // Эпоха по пакетам из batch_size столбцов; возвращает сумму потерь по всем примерам
+    Scalar train_epoch(const Matrix<Scalar>& inputs,
+                       const Matrix<Scalar>& targets,
+                       int batch_size,
+                       Scalar learning_rate = Scalar(0.01)) {
+        Scalar total_loss = 0.0;
+        for (Eigen::Index start = 0; start < inputs.cols(); start += batch_size) {
+            Eigen::Index count = std::min<Eigen::Index>(batch_size, inputs.cols() - start);
+            total_loss += train(Matrix<Scalar>(inputs.middleCols(start, count)),
+                                Matrix<Scalar>(targets.middleCols(start, count)),
+                                learning_rate);
+        }
+        return total_loss;
+    }
+};
+
+// Асинхронный SGD в стиле Hogwild: каждый поток идёт по своей части эпохи пакетами
+// по batch_size и сразу обновляет общие веса слоёв, без блокировок и без свёртки.
+// Записи потоков в одни и те же веса намеренно не синхронизированы: обновление
+// другого потока может быть потеряно или прочитано наполовину применённым, что
+// Hogwild допускает - на разреженных входах потоки редко задевают одни и те же
+// столбцы. Формально это гонка данных; на x86-64 выровненные float/double не рвутся.
+// Оптимизатор сети не используется - правило всегда SGD
+template <typename Scalar>
+class HogwildTrainer {
+private:
+    using Workspace = typename Layer<Scalar>::Workspace;
+
+    NeuralNetwork<Scalar>& network;
+    WorkerPool pool;
+    std::vector<std::vector<Workspace>> workspaces;  // [поток][слой]
+    std::vector<Scalar> losses;
+
+    Scalar step(std::vector<Workspace>& ws,
+                const Eigen::Ref<const Matrix<Scalar>>& inputs,
+                const Matrix<Scalar>& targets,
+                Scalar learning_rate) {
+        const auto& layers = network.layers;
+        const Matrix<Scalar>* output = &layers[0]->forward(inputs, ws[0]);
+        for (size_t l = 1; l < layers.size(); ++l) {
+            output = &layers[l]->forward(*output, ws[l]);
+        }
+
+        Scalar loss_val = network.loss_function->loss(*output, targets);
+
+        size_t l = layers.size() - 1;
+        Matrix<Scalar> gradient;
+        if (network.fused_output()) {
+            gradient = layers[l]->step_unsynchronized(network.loss_function->softmaxDelta(*output, targets),
+                                                      ws[l], learning_rate);
+        } else {
+            gradient = network.loss_function->derivative(*output, targets);
+            gradient = layers[l]->step_unsynchronized(layers[l]->delta(gradient, ws[l]), ws[l], learning_rate);
+        }
+        while (l-- > 0) {
+            gradient = layers[l]->step_unsynchronized(layers[l]->delta(gradient, ws[l]), ws[l], learning_rate);
+        }
+        return loss_val;
+    }
 
-class Sigmoid : public ActivationFunction {
 public:
-    Sigmoid() : ActivationFunction(true) {}  // Инициализируем поле
-    
-    Eigen::VectorXd activate(const Eigen::VectorXd& x) override {
-        return (1.0 + (-x).array().exp()).inverse();
+    HogwildTrainer(NeuralNetwork<Scalar>& network, int threads)
+        : network(network), pool(std::max(threads, 1)), workspaces(pool.size()), losses(pool.size()) {}
+
+    int threads() const {
+        return pool.size();
     }
-    
-    Eigen::VectorXd derivative(const Eigen::VectorXd& x) override {
-        Eigen::VectorXd s = activate(x);
-        return s.array() * (1.0 - s.array());
+
+    // Эпоха: примеры делятся на непрерывные части по потокам; возвращает сумму потерь,
+    // посчитанных каждым потоком по весам на момент своего прямого прохода
+    Scalar train_epoch(const Matrix<Scalar>& inputs,
+                       const Matrix<Scalar>& targets,
+                       int batch_size,
+                       Scalar learning_rate = Scalar(0.01)) {
+        AllocationScope allocations("HogwildTrainer::train_epoch");
+        const Eigen::Index columns = inputs.cols();
+        for (auto& ws : workspaces) {
+            ws.resize(network.layers.size());
+        }
+
+        pool.run([&](int worker) {
+            Eigen::Index begin = columns * worker / pool.size();
+            Eigen::Index end = columns * (worker + 1) / pool.size();
+            losses[worker] = 0;
+            for (Eigen::Index start = begin; start < end; start += batch_size) {
+                Eigen::Index count = std::min<Eigen::Index>(batch_size, end - start);
+                losses[worker] += step(workspaces[worker],
+                                       inputs.middleCols(start, count),
+                                       Matrix<Scalar>(targets.middleCols(start, count)),
+                                       learning_rate);
+            }
+        });
+
+        Scalar total_loss = 0;
+        for (Scalar loss : losses) {
+            total_loss += loss;
+        }
+        return total_loss;
     }
 };
 
-class ReLU : public ActivationFunction {
+// Инференс отдельно от обучения: копия весов на момент создания, которую predict
+// только читает. Движок не хранит ничего между вызовами - промежуточные выходы
+// слоёв лежат в Scratch вызывающего (одна на поток), поэтому один движок можно
+// вызывать из многих потоков одновременно, пока сеть продолжает обучаться
+template <typename Scalar>
+class InferenceEngine {
 public:
-    ReLU() : ActivationFunction(true) {}  // Инициализируем поле
-    
-    Eigen::VectorXd activate(const Eigen::VectorXd& x) override {
-        return x.cwiseMax(0.0);
-    }
-    
-    Eigen::VectorXd derivative(const Eigen::VectorXd& x) override {
-        Eigen::VectorXd activated = activate(x);
-        return (activated.array() > 0.0).cast<double>();
-    }
-};
+    // Рабочая память одного потока; после первого пакета того же размера не перевыделяется
+    struct Scratch {
+        std::vector<Matrix<Scalar>> hidden;
+    };
+
+private:
+    struct LayerSnapshot {
+        Matrix<Scalar> weights;
+        Vector<Scalar> biases;
+        const ActivationFunction<Scalar>* activation;
+    };
+
+    std::vector<LayerSnapshot> layers;
 
-class Softmax : public ActivationFunction {
 public:
-    Softmax() : ActivationFunction(false) {}
-    
-        Eigen::VectorXd activate(const Eigen::VectorXd& x) override {
-        double max_val = x.maxCoeff();
-        Eigen::VectorXd exp_x = (x.array() - max_val).exp();
-        double sum = exp_x.sum();
-        return exp_x / sum;
+    explicit InferenceEngine(const NeuralNetwork<Scalar>& network) {
+        for (const auto* layer : network.layers) {
+            layers.push_back({layer->getWeights(), layer->getBiases(), &layer->activation});
+        }
     }
-    
-    Eigen::VectorXd derivative(const Eigen::VectorXd& x) override {
-        Eigen::VectorXd s = activate(x);
-        return s.array() * (1.0 - s.array());
+
+    // inputs - столбец на пример (без копирования); вероятности пишутся в outputs
+    void predict(const Eigen::Ref<const Matrix<Scalar>>& inputs, Matrix<Scalar>& outputs, Scratch& scratch) const {
+        scratch.hidden.resize(layers.size() - 1);
+        for (size_t l = 0; l < layers.size(); ++l) {
+            Matrix<Scalar>& out = l + 1 == layers.size() ? outputs : scratch.hidden[l];
+            if (l == 0) {
+                out.noalias() = layers[l].weights * inputs;
+            } else {
+                out.noalias() = layers[l].weights * scratch.hidden[l - 1];
+            }
+            layers[l].activation->forward(out, layers[l].biases, out);
+        }
     }
-    
-    Eigen::MatrixXd jacobian(const Eigen::VectorXd& x) override {
-        Eigen::VectorXd s = activate(x);
-        Eigen::MatrixXd diag_s = Eigen::MatrixXd(s.asDiagonal());
-        return diag_s - s * s.transpose();
+
+    // Память под веса и смещения снимка
+    size_t weight_bytes() const {
+        size_t bytes = 0;
+        for (const auto& layer : layers) {
+            bytes += (layer.weights.size() + layer.biases.size()) * sizeof(Scalar);
+        }
+        return bytes;
     }
 };
 
-class LossFunction {
-public:
-    virtual double loss(const Eigen::VectorXd& predicted, const Eigen::VectorXd& target) = 0;
+#if defined(__AVX2__)
+// Накопление u8 x s8 по четвёркам байт в int32. Входы ограничены 0..127: тогда пары
+// maddubs (u8*s8 + u8*s8) не насыщают int16
+inline __m256i accumulate_u8s8(__m256i acc, __m256i a, __m256i b) {
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    return _mm256_dpbusd_epi32(acc, a, b);
+#elif defined(__AVXVNNI__)
+    return _mm256_dpbusd_avx_epi32(acc, a, b);
+#else
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), _mm256_set1_epi16(1)));
+#endif
+}
 
-    virtual Eigen::VectorXd derivative(const Eigen::VectorXd& predicted, const Eigen::VectorXd& target) = 0;
-    
-    virtual ~LossFunction() = default;
-};
+inline int32_t horizontal_sum(__m256i acc) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+#endif
 
-// Mean Squared Error (MSE)
-class MSE : public LossFunction {
-public:
-    double loss(const Eigen::VectorXd& predicted, const Eigen::VectorXd& target) override {
-        Eigen::VectorXd diff = predicted - target;
-        return diff.squaredNorm() / predicted.size();
+// Скалярное произведение u8 x s8 с накоплением в int32; n кратно 32
+inline int32_t dot_u8s8(const uint8_t* a, const int8_t* b, size_t n) {
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 32) {
+        acc = accumulate_u8s8(acc,
+                              _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                              _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
     }
-    
-    Eigen::VectorXd derivative(const Eigen::VectorXd& predicted, const Eigen::VectorXd& target) override {
-        return 2.0 * (predicted - target) / predicted.size();
+    return horizontal_sum(acc);
+#elif defined(__SSE2__)
+    // Базовый x86-64 без AVX2: расширяем байты до int16 и складываем через madd
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i sign = _mm_cmpgt_epi8(zero, vb);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, sign)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, sign)));
     }
-};
-
-class Layer {
-protected:
-    Eigen::MatrixXd weights;
-    Eigen::VectorXd biases;
-    Eigen::VectorXd last_z;  // Сохраняем z для backward
-    Eigen::VectorXd last_input;  // Сохраняем input для backward
-    
-public:
-    int input_size;
-    int output_size;
-    ActivationFunction& activation;
-    
-    Layer(int input_size, int output_size, ActivationFunction& activation)
-        : input_size(input_size), output_size(output_size), activation(activation),
-          weights(output_size, input_size), biases(output_size) {
-        // Xavier initialization
-        double limit = std::sqrt(6.0 / (input_size + output_size));
-        weights = Eigen::MatrixXd::Random(output_size, input_size) * limit;        
-        biases.setZero();
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+#else
+    int32_t acc = 0;
+    for (size_t i = 0; i < n; ++i) {
+        acc += int32_t(a[i]) * int32_t(b[i]);
     }
-    
-    Eigen::VectorXd forward(const Eigen::VectorXd& input) {
-        last_input = input; 
-        last_z = weights * input + biases; 
-        return activation.activate(last_z);
+    return acc;
+#endif
+}
+
+// Четыре произведения одной строки весов на четыре входа, лежащих через stride байт:
+// строка читается из памяти один раз на четыре примера
+inline void dot4_u8s8(const uint8_t* a, size_t stride, const int8_t* b, size_t n, int32_t* out) {
+#if defined(__AVX2__)
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    __m256i acc2 = _mm256_setzero_si256();
+    __m256i acc3 = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 32) {
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        acc0 = accumulate_u8s8(acc0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)), vb);
+        acc1 = accumulate_u8s8(acc1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + stride + i)), vb);
+        acc2 = accumulate_u8s8(acc2, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + 2 * stride + i)), vb);
+        acc3 = accumulate_u8s8(acc3, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + 3 * stride + i)), vb);
     }
-    
-    Eigen::VectorXd backward(const Eigen::VectorXd& gradient, double learning_rate = 0.01) {
-        Eigen::VectorXd delta;
-        
-        if (activation.getSupportsHadamardDerivative()) {
-            // Для hadamard-совместимых функций используем derivative() и hadamard
-            Eigen::VectorXd activation_grad = activation.derivative(last_z);
-            delta = gradient.array() * activation_grad.array();  // Hadamard product
-        } else {
-            // Для softmax используем jacobian() и матричное умножение
-            Eigen::MatrixXd J = activation.jacobian(last_z);
-            delta = J * gradient;  // Матричное умножение
-        }
-        
-        // Сохраняем старые веса для вычисления градиента предыдущего слоя
-        Eigen::MatrixXd old_weights = weights;
-        
-        // Обновляем веса и смещения
-        weights -= learning_rate * delta * last_input.transpose();
-        biases -= learning_rate * delta;
-        
-        // Возвращаем градиент для предыдущего слоя (используем старые веса)
-        return old_weights.transpose() * delta; 
+    out[0] = horizontal_sum(acc0);
+    out[1] = horizontal_sum(acc1);
+    out[2] = horizontal_sum(acc2);
+    out[3] = horizontal_sum(acc3);
+#else
+    for (int k = 0; k < 4; ++k) {
+        out[k] = dot_u8s8(a + k * stride, b, n);
     }
-};
+#endif
+}
+
+// Квантованная после обучения модель: веса int8 с масштабом на строку, входы слоёв
+// uint8 (0..127) с масштабом на слой, подобранным по калибровочным данным.
+// Умножения матрицы на вектор целочисленные (VNNI/AVX2 при сборке под процессор),
+// смещение, активация и softmax считаются в Scalar после деквантования.
+// Схема рассчитана на неотрицательные входы слоёв: пиксели, Sigmoid, ReLU
+template <typename Scalar>
+class QuantizedNetwork {
+public:
+    // Рабочая память одного потока
+    struct Scratch {
+        std::vector<std::vector<uint8_t>> inputs;  // квантованные входы слоя, до четырёх примеров
+        Matrix<Scalar> z;
+    };
 
-class NeuralNetwork {
 private:
-    std::vector<Layer*> layers;
-    LossFunction* loss_function;
-    
+    struct QuantizedLayer {
+        Eigen::Index input_size;
+        Eigen::Index output_size;
+        size_t stride;  // длина строки с выравниванием до 32 байт
+        std::vector<int8_t> weights;  // по строкам
+        Vector<Scalar> row_scales;  // масштаб строки весов * масштаб входа
+        Vector<Scalar> biases;
+        Scalar input_scale;  // вход = q * input_scale
+        const ActivationFunction<Scalar>* activation;
+    };
+
+    std::vector<QuantizedLayer> layers;
+
+    static void quantize_input(const Eigen::Ref<const Vector<Scalar>>& x, Scalar scale, uint8_t* out) {
+        Eigen::Map<Eigen::Array<uint8_t, Eigen::Dynamic, 1>> q(out, x.size());
+        // Округление через +0.5 и отбрасывание дробной части: значения уже неотрицательны,
+        // а такое выражение Eigen векторизует, в отличие от round()
+        q = ((x.array() * (Scalar(1) / scale)).max(Scalar(0)).min(Scalar(127)) + Scalar(0.5)).template cast<uint8_t>();
+    }
+
 public:
-    NeuralNetwork(LossFunction* loss) : loss_function(loss) {}
-    
-    ~NeuralNetwork() {
-        for (auto* layer : layers) {
-            delete layer;
+    // calibration - столбец на пример; по нему берётся максимум входа каждого слоя
+    QuantizedNetwork(const NeuralNetwork<Scalar>& network, const Matrix<Scalar>& calibration) {
+        std::vector<typename Layer<Scalar>::Workspace> workspaces(network.layers.size());
+        const Matrix<Scalar>* input = &calibration;
+        for (size_t l = 0; l < network.layers.size(); ++l) {
+            const Layer<Scalar>& layer = *network.layers[l];
+            if (input->minCoeff() < 0) {
+                throw std::invalid_argument("Квантование требует неотрицательных входов слоёв");
+            }
+            Scalar input_max = input->maxCoeff();
+
+            QuantizedLayer q;
+            q.input_size = layer.input_size;
+            q.output_size = layer.output_size;
+            q.stride = (layer.input_size + 31) / 32 * 32;
+            q.weights.assign(q.stride * layer.output_size, 0);
+            q.row_scales.resize(layer.output_size);
+            q.biases = layer.getBiases();
+            q.input_scale = input_max > 0 ? input_max / Scalar(127) : Scalar(1);
+            q.activation = &layer.activation;
+
+            const Matrix<Scalar>& weights = layer.getWeights();
+            for (Eigen::Index r = 0; r < weights.rows(); ++r) {
+                Scalar row_max = weights.row(r).cwiseAbs().maxCoeff();
+                Scalar weight_scale = row_max > 0 ? row_max / Scalar(127) : Scalar(1);
+                for (Eigen::Index c = 0; c < weights.cols(); ++c) {
+                    q.weights[r * q.stride + c] = static_cast<int8_t>(std::round(weights(r, c) / weight_scale));
+                }
+                q.row_scales(r) = weight_scale * q.input_scale;
+            }
+            layers.push_back(std::move(q));
+
+            input = &layer.forward(*input, workspaces[l]);
         }
     }
-    
-    void addLayer(Layer* layer) {
-        layers.push_back(layer);
-    }
-    
-    Eigen::VectorXd forward(const Eigen::VectorXd& input) {
-        Eigen::VectorXd x = input;
-        for (auto* layer : layers) {
-            x = layer->forward(x);
+
+    // inputs - столбец на пример; вероятности пишутся в outputs.
+    // Примеры идут четвёрками, чтобы каждая строка весов читалась один раз на четыре
+    void predict(const Eigen::Ref<const Matrix<Scalar>>& inputs, Matrix<Scalar>& outputs, Scratch& scratch) const {
+        const Eigen::Index block = 4;
+        scratch.inputs.resize(layers.size());
+        for (size_t l = 0; l < layers.size(); ++l) {
+            scratch.inputs[l].resize(layers[l].stride * block, 0);
         }
-        return x;
-    }
-    
-    double train(const Eigen::VectorXd& input, const Eigen::VectorXd& target, double learning_rate = 0.01) {
-        // Forward pass
-        Eigen::VectorXd output = forward(input);
-        
-        // Вычисляем loss
-        double loss_val = loss_function->loss(output, target);
-        
-        // Backward pass
-        Eigen::VectorXd gradient = loss_function->derivative(output, target);
-        for (auto it = layers.rbegin(); it != layers.rend(); ++it) {
-            gradient = (*it)->backward(gradient, learning_rate);
+        outputs.resize(layers.back().output_size, inputs.cols());
+
+        for (Eigen::Index j = 0; j < inputs.cols(); j += block) {
+            Eigen::Index count = std::min(block, inputs.cols() - j);
+            for (Eigen::Index k = 0; k < count; ++k) {
+                quantize_input(inputs.col(j + k), layers[0].input_scale, &scratch.inputs[0][k * layers[0].stride]);
+            }
+            for (size_t l = 0; l < layers.size(); ++l) {
+                const QuantizedLayer& layer = layers[l];
+                const uint8_t* input = scratch.inputs[l].data();
+                scratch.z.resize(layer.output_size, count);
+                for (Eigen::Index r = 0; r < layer.output_size; ++r) {
+                    const int8_t* row = &layer.weights[r * layer.stride];
+                    int32_t acc[block];
+                    if (count == block) {
+                        dot4_u8s8(input, layer.stride, row, layer.stride, acc);
+                    } else {
+                        for (Eigen::Index k = 0; k < count; ++k) {
+                            acc[k] = dot_u8s8(input + k * layer.stride, row, layer.stride);
+                        }
+                    }
+                    for (Eigen::Index k = 0; k < count; ++k) {
+                        scratch.z(r, k) = Scalar(acc[k]) * layer.row_scales(r);
+                    }
+                }
+                layer.activation->forward(scratch.z, layer.biases, scratch.z);
+                if (l + 1 < layers.size()) {
+                    for (Eigen::Index k = 0; k < count; ++k) {
+                        quantize_input(scratch.z.col(k), layers[l + 1].input_scale,
+                                       &scratch.inputs[l + 1][k * layers[l + 1].stride]);
+                    }
+                } else {
+                    outputs.middleCols(j, count) = scratch.z;
+                }
+            }
         }
-        
-        return loss_val;
     }
-    
-    Eigen::VectorXd predict(const Eigen::VectorXd& input) {
-        return forward(input);
+
+    // Память под веса и параметры квантования
+    size_t weight_bytes() const {
+        size_t bytes = 0;
+        for (const auto& layer : layers) {
+            bytes += layer.weights.size() + (layer.row_scales.size() + layer.biases.size()) * sizeof(Scalar);
+        }
+        return bytes;
     }
 };
 
@@ -229,6 +1619,45 @@ private:
     }
     
 public:
+    // Файл цифр: "STDIGIT1", число изображений (uint32), ширина и высота (uint16), затем
+    // изображения по (ширина * высота + 7) / 8 байт - пиксели построчно, младший бит
+    // первым - и метки по байту на изображение. Изображение 20x20 занимает 50 байт.
+    // images - столбец на изображение (пиксель закрашен, если > 0.5), targets - one-hot
+    static void savePacked(const std::string& path,
+                           const Eigen::MatrixXd& images,
+                           const Eigen::MatrixXd& targets,
+                           int width = DIGIT_SIZE,
+                           int height = DIGIT_SIZE) {
+        std::ofstream out(path, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Не удалось создать файл цифр: " + path);
+        }
+        uint32_t count = static_cast<uint32_t>(images.cols());
+        uint16_t size[] = {static_cast<uint16_t>(width), static_cast<uint16_t>(height)};
+        out.write("STDIGIT1", 8);
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        out.write(reinterpret_cast<const char*>(size), sizeof(size));
+
+        std::vector<uint8_t> packed((static_cast<size_t>(width) * height + 7) / 8);
+        for (Eigen::Index j = 0; j < images.cols(); ++j) {
+            std::fill(packed.begin(), packed.end(), 0);
+            for (Eigen::Index p = 0; p < images.rows(); ++p) {
+                if (images(p, j) > 0.5) {
+                    packed[p / 8] |= static_cast<uint8_t>(1u << (p % 8));
+                }
+            }
+            out.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+        }
+        for (Eigen::Index j = 0; j < targets.cols(); ++j) {
+            Eigen::Index label;
+            targets.col(j).maxCoeff(&label);
+            out.put(static_cast<char>(label));
+        }
+        if (!out) {
+            throw std::runtime_error("Ошибка записи файла цифр: " + path);
+        }
+    }
+
     // Функция для отображения цифры из вектора (20x20 = 400 пикселей)
     static void displayDigit(const Eigen::VectorXd& digit, int width = DIGIT_SIZE, int height = DIGIT_SIZE) {
         for (int i = 0; i < height; ++i) {
@@ -323,38 +1752,639 @@ public:
     }
 };
 
-int main() {
+// Файл цифр из DigitDataset::savePacked(), отображённый в память: открывается сразу,
+// а в памяти процесса оказываются только прочитанные страницы. Пакеты разворачиваются
+// из битов прямо в буферы входов сети
+class MappedDigitFile {
+private:
+    int fd = -1;
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+
+    uint32_t count = 0;
+    int width = 0;
+    int height = 0;
+    size_t image_bytes = 0;
+    const uint8_t* images = nullptr;
+    const uint8_t* labels = nullptr;
+
+    static const size_t header_size = 8 + sizeof(uint32_t) + 2 * sizeof(uint16_t);
+
+    // Поля файла не выровнены - читаем через memcpy
+    template <typename T>
+    static T load(const uint8_t* at) {
+        T value;
+        std::memcpy(&value, at, sizeof(value));
+        return value;
+    }
+
+    void release() {
+        if (data) {
+            ::munmap(const_cast<uint8_t*>(data), length);
+            data = nullptr;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+public:
+    explicit MappedDigitFile(const std::string& path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || ::fstat(fd, &info) != 0) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            throw std::runtime_error("Не удалось открыть файл цифр: " + path);
+        }
+        length = static_cast<size_t>(info.st_size);
+        void* mapped = length > 0 ? ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Не удалось отобразить файл цифр: " + path);
+        }
+        data = static_cast<const uint8_t*>(mapped);
+        ::madvise(mapped, length, MADV_SEQUENTIAL);  // эпоха читает файл подряд
+
+        if (length < header_size || std::string(reinterpret_cast<const char*>(data), 8) != "STDIGIT1") {
+            release();
+            throw std::runtime_error("Файл цифр повреждён: " + path);
+        }
+        count = load<uint32_t>(data + 8);
+        width = load<uint16_t>(data + 12);
+        height = load<uint16_t>(data + 14);
+        image_bytes = (static_cast<size_t>(width) * height + 7) / 8;
+
+        images = data + header_size;
+        labels = images + static_cast<size_t>(count) * image_bytes;
+        if (static_cast<size_t>(labels + count - data) != length ||
+            std::any_of(labels, labels + count, [](uint8_t label) { return label > 9; })) {
+            release();
+            throw std::runtime_error("Файл цифр повреждён: " + path);
+        }
+    }
+
+    MappedDigitFile(const MappedDigitFile&) = delete;
+    MappedDigitFile& operator=(const MappedDigitFile&) = delete;
+
+    ~MappedDigitFile() {
+        release();
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    int pixels() const {
+        return width * height;
+    }
+
+    size_t bytes() const {
+        return length;
+    }
+
+    // Изображения [first, first + inputs.cols()) - в столбцы inputs (0/1), метки - в one-hot targets
+    void expand(size_t first, Eigen::Ref<Eigen::MatrixXd> inputs, Eigen::Ref<Eigen::MatrixXd> targets) const {
+        const int size = pixels();
+        for (Eigen::Index j = 0; j < inputs.cols(); ++j) {
+            const uint8_t* image = images + (first + j) * image_bytes;
+            for (int p = 0; p < size; ++p) {
+                inputs(p, j) = (image[p >> 3] >> (p & 7)) & 1;
+            }
+            targets.col(j).setZero();
+            targets(labels[first + j], j) = 1.0;
+        }
+    }
+};
+
+// Итог обучения одной модели для сравнения точности чисел
+struct PrecisionReport {
+    double final_loss;
+    int correct;
+    double train_ms;
+    Eigen::MatrixXd predictions;  // столбец на пример, приведён к double
+};
+
+// Обучаем ту же архитектуру на типе Scalar и оцениваем её на датасете
+template <typename Scalar, template <typename> class Hidden>
+PrecisionReport train_and_evaluate(const std::vector<std::pair<Eigen::VectorXd, Eigen::VectorXd>>& dataset,
+                                   int epochs,
+                                   double learning_rate,
+                                   int batch_size) {
+    Matrix<Scalar> inputs(400, dataset.size());
+    Matrix<Scalar> targets(10, dataset.size());
+    for (size_t i = 0; i < dataset.size(); ++i) {
+        inputs.col(i) = dataset[i].first.cast<Scalar>();
+        targets.col(i) = dataset[i].second.cast<Scalar>();
+    }
+
+    std::srand(1);  // одинаковые начальные веса для float и double
+    Hidden<Scalar> hidden;
+    Softmax<Scalar> softmax_output;
+    MSE<Scalar> mse_loss;
+    NeuralNetwork<Scalar> nn(&mse_loss);
+    nn.addLayer(new Layer<Scalar>(400, 128, hidden));
+    nn.addLayer(new Layer<Scalar>(128, 10, softmax_output));
+
+    PrecisionReport report{0.0, 0, 0.0, Eigen::MatrixXd(10, dataset.size())};
+    auto start = std::chrono::steady_clock::now();
+    for (int epoch = 0; epoch < epochs; ++epoch) {
+        Scalar total_loss = 0;
+        if (batch_size > 0) {
+            total_loss = nn.train_epoch(inputs, targets, batch_size, Scalar(learning_rate));
+        } else {
+            for (Eigen::Index i = 0; i < inputs.cols(); ++i) {
+                total_loss += nn.train(Vector<Scalar>(inputs.col(i)), Vector<Scalar>(targets.col(i)), Scalar(learning_rate));
+            }
+        }
+        report.final_loss = static_cast<double>(total_loss) / dataset.size();
+    }
+    report.train_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t i = 0; i < dataset.size(); ++i) {
+        Vector<Scalar> prediction = nn.predict(Vector<Scalar>(inputs.col(i)));
+        Eigen::Index predicted_digit;
+        Eigen::Index expected_digit;
+        prediction.maxCoeff(&predicted_digit);
+        dataset[i].second.maxCoeff(&expected_digit);
+        report.correct += predicted_digit == expected_digit;
+        report.predictions.col(i) = prediction.template cast<double>();
+    }
+    return report;
+}
+
+// Зашумлённые копии цифр датасета (каждый пиксель инвертируется с вероятностью noise):
+// на 10 примерах параллелить нечего, а масштабирование нужно мерить на больших пакетах
+void make_noisy_copies(const std::vector<std::pair<Eigen::VectorXd, Eigen::VectorXd>>& dataset,
+                       int count, double noise, Eigen::MatrixXd& inputs, Eigen::MatrixXd& targets) {
+    std::mt19937 rng(42);
+    std::bernoulli_distribution flip(noise);
+    inputs.resize(dataset[0].first.size(), count);
+    targets.resize(dataset[0].second.size(), count);
+    for (int i = 0; i < count; ++i) {
+        const auto& [digit, target] = dataset[i % dataset.size()];
+        for (Eigen::Index p = 0; p < digit.size(); ++p) {
+            inputs(p, i) = flip(rng) ? 1.0 - digit(p) : digit(p);
+        }
+        targets.col(i) = target;
+    }
+}
+
+// Время эпохи параллельного обучения для 1..max_threads потоков на одной и той же модели
+template <template <typename> class Hidden>
+void report_scaling(const std::vector<std::pair<Eigen::VectorXd, Eigen::VectorXd>>& dataset, int max_threads) {
+    const int samples = 4096;
+    const int batch_size = 256;
+    const int epochs = 5;
+    Eigen::MatrixXd inputs;
+    Eigen::MatrixXd targets;
+    make_noisy_copies(dataset, samples, 0.02, inputs, targets);
+
+    std::cout << "=== Масштабирование по потокам (" << samples << " примеров, пакеты по "
+              << batch_size << ", " << epochs << " эпох) ===" << std::endl;
+    double single_ms = 0.0;
+    for (int threads = 1; threads <= max_threads; ++threads) {
+        std::srand(1);  // одинаковые начальные веса для каждого числа потоков
+        Hidden<double> hidden;
+        Softmax<double> softmax_output;
+        MSE<double> mse_loss;
+        NeuralNetwork<double> nn(&mse_loss);
+        nn.addLayer(new Layer<double>(400, 128, hidden));
+        nn.addLayer(new Layer<double>(128, 10, softmax_output));
+        DataParallelTrainer<double> trainer(nn, threads);
+
+        double loss = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        for (int epoch = 0; epoch < epochs; ++epoch) {
+            loss = trainer.train_epoch(inputs, targets, batch_size, 0.1) / samples;
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / epochs;
+        if (threads == 1) {
+            single_ms = ms;
+        }
+        std::cout << "Потоков: " << threads << ", " << ms << " мс на эпоху, ускорение "
+                  << single_ms / ms << "x, потери " << loss << std::endl;
+    }
+}
+
+// Синхронное параллельное обучение и Hogwild рядом: потери по эпохам, скорость
+// в примерах в секунду и точность на исходных цифрах при одинаковых потоках и пакетах
+template <template <typename> class Hidden>
+void compare_hogwild(const std::vector<std::pair<Eigen::VectorXd, Eigen::VectorXd>>& dataset,
+                     int threads, int batch_size, double learning_rate) {
+    const int samples = 4096;
+    const int epochs = 10;
+    Eigen::MatrixXd inputs;
+    Eigen::MatrixXd targets;
+    make_noisy_copies(dataset, samples, 0.02, inputs, targets);
+
+    struct Run {
+        const char* name;
+        std::vector<double> losses;
+        double seconds = 0.0;
+        int correct = 0;
+    };
+    Run runs[2] = {{"синхронно", {}, 0.0, 0}, {"Hogwild", {}, 0.0, 0}};
+    for (int mode = 0; mode < 2; ++mode) {
+        std::srand(1);  // одинаковые начальные веса для обоих режимов
+        Hidden<double> hidden;
+        Softmax<double> softmax_output;
+        MSE<double> mse_loss;
+        NeuralNetwork<double> nn(&mse_loss);
+        auto* input_layer = new Layer<double>(400, 128, hidden);
+        input_layer->enableSparseInput();
+        nn.addLayer(input_layer);
+        nn.addLayer(new Layer<double>(128, 10, softmax_output));
+        DataParallelTrainer<double> synchronous(nn, mode == 0 ? threads : 1);
+        HogwildTrainer<double> hogwild(nn, mode == 1 ? threads : 1);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int epoch = 0; epoch < epochs; ++epoch) {
+            double loss = mode == 0 ? synchronous.train_epoch(inputs, targets, batch_size, learning_rate)
+                                    : hogwild.train_epoch(inputs, targets, batch_size, learning_rate);
+            runs[mode].losses.push_back(loss / samples);
+        }
+        runs[mode].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        for (size_t i = 0; i < dataset.size(); ++i) {
+            Eigen::Index predicted_digit;
+            Eigen::Index expected_digit;
+            nn.predict(dataset[i].first).maxCoeff(&predicted_digit);
+            dataset[i].second.maxCoeff(&expected_digit);
+            runs[mode].correct += predicted_digit == expected_digit;
+        }
+    }
+
+    std::cout << "=== Синхронно и Hogwild (потоков: " << threads << ", пакеты по " << batch_size
+              << ", " << samples << " примеров) ===" << std::endl;
+    for (int epoch = 0; epoch < epochs; ++epoch) {
+        std::cout << "Epoch " << epoch << ", Loss: " << runs[0].name << " " << runs[0].losses[epoch]
+                  << ", " << runs[1].name << " " << runs[1].losses[epoch] << std::endl;
+    }
+    for (const auto& run : runs) {
+        std::cout << run.name << ": " << samples * epochs / run.seconds << " примеров/с, верно "
+                  << run.correct << "/" << dataset.size() << std::endl;
+    }
+}
+
+// Один движок инференса, несколько потоков-клиентов со своей Scratch: пропускная
+// способность и проверка, что ответы совпадают с однопоточными
+void report_serving(const InferenceEngine<double>& engine,
+                    const std::vector<std::pair<Eigen::VectorXd, Eigen::VectorXd>>& dataset,
+                    int threads) {
+    const int samples = 4096;
+    const int batch_size = 64;
+    const int rounds = 20;
+    Eigen::MatrixXd inputs;
+    Eigen::MatrixXd targets;
+    make_noisy_copies(dataset, samples, 0.02, inputs, targets);
+
+    Eigen::MatrixXd reference;
+    InferenceEngine<double>::Scratch reference_scratch;
+    engine.predict(inputs, reference, reference_scratch);
+
+    std::vector<int> mismatches(threads, 0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (int t = 0; t < threads; ++t) {
+        clients.emplace_back([&, t] {
+            InferenceEngine<double>::Scratch scratch;
+            Eigen::MatrixXd outputs;
+            for (int round = 0; round < rounds; ++round) {
+                for (Eigen::Index begin = 0; begin < samples; begin += batch_size) {
+                    engine.predict(inputs.middleCols(begin, batch_size), outputs, scratch);
+                    mismatches[t] += outputs != reference.middleCols(begin, batch_size);
+                }
+            }
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int total_mismatches = 0;
+    for (int count : mismatches) {
+        total_mismatches += count;
+    }
+    std::cout << "=== Инференс из " << threads << " потоков (пакеты по " << batch_size << ") ===" << std::endl;
+    std::cout << "Примеров/с: " << static_cast<double>(samples) * rounds * threads / seconds
+              << ", пакетов с расхождением: " << total_mismatches << std::endl;
+}
+
+// Квантованная int8 модель против исходной double: точность, совпадение ответов,
+// скорость и память под веса. Калибровка - по исходным цифрам датасета
+void report_quantization(const NeuralNetwork<double>& nn,
+                         const InferenceEngine<double>& engine,
+                         const std::vector<std::pair<Eigen::VectorXd, Eigen::VectorXd>>& dataset) {
+    const int samples = 4096;
+    const int rounds = 5;
+    Eigen::MatrixXd calibration(dataset[0].first.size(), dataset.size());
+    for (size_t i = 0; i < dataset.size(); ++i) {
+        calibration.col(i) = dataset[i].first;
+    }
+    QuantizedNetwork<double> quantized(nn, calibration);
+
+    Eigen::MatrixXd inputs;
+    Eigen::MatrixXd targets;
+    make_noisy_copies(dataset, samples, 0.02, inputs, targets);
+
+    Eigen::MatrixXd exact;
+    Eigen::MatrixXd approximate;
+    InferenceEngine<double>::Scratch engine_scratch;
+    QuantizedNetwork<double>::Scratch quantized_scratch;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round) {
+        engine.predict(inputs, exact, engine_scratch);
+    }
+    double exact_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round) {
+        quantized.predict(inputs, approximate, quantized_scratch);
+    }
+    double approximate_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int exact_correct = 0;
+    int approximate_correct = 0;
+    int agree = 0;
+    for (int i = 0; i < samples; ++i) {
+        Eigen::Index expected_digit;
+        Eigen::Index exact_digit;
+        Eigen::Index approximate_digit;
+        targets.col(i).maxCoeff(&expected_digit);
+        exact.col(i).maxCoeff(&exact_digit);
+        approximate.col(i).maxCoeff(&approximate_digit);
+        exact_correct += exact_digit == expected_digit;
+        approximate_correct += approximate_digit == expected_digit;
+        agree += exact_digit == approximate_digit;
+    }
+
+    std::cout << "=== int8 и double (" << samples << " зашумлённых примеров) ===" << std::endl;
+    std::cout << "double: верно " << exact_correct << "/" << samples
+              << ", " << samples * rounds / exact_seconds << " примеров/с"
+              << ", веса " << engine.weight_bytes() << " байт" << std::endl;
+    std::cout << "int8: верно " << approximate_correct << "/" << samples
+              << ", " << samples * rounds / approximate_seconds << " примеров/с"
+              << ", веса " << quantized.weight_bytes() << " байт" << std::endl;
+    std::cout << "Совпадение ответов: " << agree << "/" << samples
+              << ", наибольшее расхождение вероятностей: " << (exact - approximate).cwiseAbs().maxCoeff()
+              << ", ускорение int8: " << exact_seconds / approximate_seconds << "x" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    // --batch N: обучение пакетами по N примеров (градиент усредняется по пакету)
+    // --optimizer sgd|momentum|adam, --lr X: оптимизатор и шаг обучения
+    // --loss mse|ce: функция потерь (ce - перекрёстная энтропия, объединённая с Softmax)
+    // --compare-precision: обучить модель на float и на double и сравнить точность и скорость
+    // --threads N: параллельное по данным обучение на N потоках (без --batch - весь датасет одним пакетом)
+    // --scaling N: замерить время эпохи на 1..N потоках
+    // --hogwild: с --threads обучать асинхронным SGD без свёртки градиентов (только --optimizer sgd)
+    // --compare-hogwild N: сравнить синхронное обучение и Hogwild на N потоках
+    // --serve N: после обучения замерить инференс из N потоков через один движок
+    // --quantize: после обучения квантовать модель в int8 и сравнить с double
+    // --dense: не использовать разреженный путь для входных пикселей первого слоя
+    // --write-dataset FILE [--copies N]: записать цифры (или N зашумлённых копий) в упакованный файл
+    // --dataset FILE: обучать по упакованному файлу, отображённому в память; --epochs N - число эпох
+    int batch_size = 0;
+    std::string optimizer_name = "sgd";
+    double learning_rate = 0.0;
+    std::string loss_name = "mse";
+    bool compare_precision = false;
+    int threads = 0;
+    int scaling_threads = 0;
+    bool hogwild_mode = false;
+    int hogwild_threads = 0;
+    int serve_threads = 0;
+    bool quantize = false;
+    bool dense_input = false;
+    std::string write_path;
+    int copies = 0;
+    std::string dataset_path;
+    int epochs = 500;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--batch" && i + 1 < argc) {
+            batch_size = std::stoi(argv[++i]);
+        } else if (arg == "--optimizer" && i + 1 < argc) {
+            optimizer_name = argv[++i];
+        } else if (arg == "--compare-precision") {
+            compare_precision = true;
+        } else if (arg == "--loss" && i + 1 < argc) {
+            loss_name = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::stoi(argv[++i]);
+        } else if (arg == "--scaling" && i + 1 < argc) {
+            scaling_threads = std::stoi(argv[++i]);
+        } else if (arg == "--hogwild") {
+            hogwild_mode = true;
+        } else if (arg == "--compare-hogwild" && i + 1 < argc) {
+            hogwild_threads = std::stoi(argv[++i]);
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serve_threads = std::stoi(argv[++i]);
+        } else if (arg == "--write-dataset" && i + 1 < argc) {
+            write_path = argv[++i];
+        } else if (arg == "--copies" && i + 1 < argc) {
+            copies = std::stoi(argv[++i]);
+        } else if (arg == "--dataset" && i + 1 < argc) {
+            dataset_path = argv[++i];
+        } else if (arg == "--epochs" && i + 1 < argc) {
+            epochs = std::stoi(argv[++i]);
+        } else if (arg == "--dense") {
+            dense_input = true;
+        } else if (arg == "--quantize") {
+            quantize = true;
+        } else if (arg == "--lr" && i + 1 < argc) {
+            learning_rate = std::stod(argv[++i]);
+        } else {
+            std::cerr << "Неизвестный аргумент: " << arg << std::endl;
+            return 1;
+        }
+    }
+
     // Создаём датасет с цифрами
     auto dataset = DigitDataset::createDataset();
+
+    if (compare_precision) {
+        const int epochs = 500;
+        auto as_double = train_and_evaluate<double, ReLU>(dataset, epochs, 0.1, batch_size);
+        auto as_float = train_and_evaluate<float, ReLU>(dataset, epochs, 0.1, batch_size);
+        std::cout << "=== float и double (" << epochs << " эпох) ===" << std::endl;
+        for (const auto& [name, report] : {std::pair<const char*, const PrecisionReport&>{"double", as_double},
+                                           std::pair<const char*, const PrecisionReport&>{"float", as_float}}) {
+            std::cout << name << ": верно " << report.correct << "/" << dataset.size()
+                      << ", потери " << report.final_loss
+                      << ", обучение " << report.train_ms << " мс" << std::endl;
+        }
+        std::cout << "Наибольшее расхождение вероятностей: "
+                  << (as_double.predictions - as_float.predictions).cwiseAbs().maxCoeff()
+                  << ", ускорение float: " << as_double.train_ms / as_float.train_ms << "x" << std::endl;
+        return 0;
+    }
+
+    if (scaling_threads > 0) {
+        report_scaling<ReLU>(dataset, scaling_threads);
+        return 0;
+    }
+
+    if (hogwild_threads > 0) {
+        compare_hogwild<ReLU>(dataset, hogwild_threads, batch_size > 0 ? batch_size : 16,
+                                learning_rate > 0 ? learning_rate : 0.1);
+        return 0;
+    }
+
+    // Тот же датасет столбцами для пакетного обучения
+    Eigen::MatrixXd inputs(400, dataset.size());
+    Eigen::MatrixXd targets(10, dataset.size());
+    for (size_t i = 0; i < dataset.size(); ++i) {
+        inputs.col(i) = dataset[i].first;
+        targets.col(i) = dataset[i].second;
+    }
+
+    if (!write_path.empty()) {
+        Eigen::MatrixXd images = inputs;
+        Eigen::MatrixXd labels = targets;
+        if (copies > 0) {
+            make_noisy_copies(dataset, copies, 0.02, images, labels);
+        }
+        DigitDataset::savePacked(write_path, images, labels);
+        std::cout << "Записано изображений: " << images.cols() << " в " << write_path << std::endl;
+        return 0;
+    }
+
+    std::unique_ptr<MappedDigitFile> packed;
+    if (!dataset_path.empty()) {
+        auto open_start = std::chrono::steady_clock::now();
+        try {
+            packed = std::make_unique<MappedDigitFile>(dataset_path);
+        } catch (const std::exception& e) {
+            std::cerr << "Ошибка: " << e.what() << std::endl;
+            return 1;
+        }
+        double open_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - open_start).count();
+        if (packed->pixels() != inputs.rows()) {
+            std::cerr << "Размер изображений в файле не " << inputs.rows() << " пикселей" << std::endl;
+            return 1;
+        }
+        std::cout << "Файл цифр: " << packed->size() << " изображений, " << packed->bytes()
+                  << " байт, открыт за " << open_ms << " мс" << std::endl;
+    }
     
     // Создаём нейронную сеть для распознавания цифр
     // Архитектура: 400 (вход 20x20) -> 128 -> 10 (выход)
-    ReLU relu1;
-    Softmax softmax_output;
+    ReLU<double> relu1;
+    Softmax<double> softmax_output;
     
-    MSE mse_loss;
-    NeuralNetwork nn(&mse_loss);
+    MSE<double> mse_loss;
+    CrossEntropy<double> cross_entropy;
+    if (loss_name != "mse" && loss_name != "ce") {
+        std::cerr << "Неизвестная функция потерь: " << loss_name << std::endl;
+        return 1;
+    }
+    NeuralNetwork<double> nn(loss_name == "ce" ? static_cast<LossFunction<double>*>(&cross_entropy) : &mse_loss);
     
-    nn.addLayer(new Layer(400, 128, relu1));
-    nn.addLayer(new Layer(128, 10, softmax_output));
+    auto* input_layer = new Layer<double>(400, 128, relu1);
+    if (!dense_input) {
+        input_layer->enableSparseInput();  // пиксели 0/1, закрашено меньше четверти
+    }
+    nn.addLayer(input_layer);
+    nn.addLayer(new Layer<double>(128, 10, softmax_output));
+
+    // Шаг по умолчанию подобран под каждый оптимизатор
+    SGD<double> sgd;
+    Momentum<double> momentum(0.9);
+    Adam<double> adam;
+    if (optimizer_name == "sgd") {
+        nn.setOptimizer(&sgd);
+        learning_rate = learning_rate > 0 ? learning_rate : 0.1;
+    } else if (optimizer_name == "momentum") {
+        nn.setOptimizer(&momentum);
+        learning_rate = learning_rate > 0 ? learning_rate : 0.01;
+    } else if (optimizer_name == "adam") {
+        nn.setOptimizer(&adam);
+        learning_rate = learning_rate > 0 ? learning_rate : 0.001;
+    } else {
+        std::cerr << "Неизвестный оптимизатор: " << optimizer_name << std::endl;
+        return 1;
+    }
+    if (hogwild_mode && optimizer_name != "sgd") {
+        // HogwildTrainer обновляет веса сам и оптимизатор сети не вызывает
+        std::cerr << "--hogwild работает только с --optimizer sgd" << std::endl;
+        return 1;
+    }
+
+    DataParallelTrainer<double> trainer(nn, hogwild_mode ? 1 : threads);
+    HogwildTrainer<double> hogwild(nn, hogwild_mode ? threads : 1);
+    if (threads > 0 && batch_size == 0) {
+        // Hogwild обновляет веса после каждого примера, синхронный - после всего датасета
+        batch_size = hogwild_mode ? 1 : static_cast<int>(dataset.size());
+    }
     
+    // Проход по примерам-столбцам выбранным способом обучения; возвращает сумму потерь
+    auto train_pass = [&](const Eigen::MatrixXd& x, const Eigen::MatrixXd& y) {
+        double loss = 0.0;
+        if (threads > 0 && hogwild_mode) {
+            loss = hogwild.train_epoch(x, y, batch_size, learning_rate);
+        } else if (threads > 0) {
+            loss = trainer.train_epoch(x, y, batch_size, learning_rate);
+        } else if (batch_size > 0) {
+            loss = nn.train_epoch(x, y, batch_size, learning_rate);
+        } else {
+            for (Eigen::Index i = 0; i < x.cols(); ++i) {
+                loss += nn.train(Eigen::VectorXd(x.col(i)), Eigen::VectorXd(y.col(i)), learning_rate);
+            }
+        }
+        return loss;
+    };
+
+    // Файл разворачивается кусками по целому числу пакетов в одни и те же буферы
+    const size_t chunk = batch_size > 0 ? static_cast<size_t>(batch_size) * std::max(1, 4096 / batch_size) : 4096;
+    Eigen::MatrixXd chunk_inputs;
+    Eigen::MatrixXd chunk_targets;
+    const double samples = packed ? packed->size() : dataset.size();
+
     std::cout << "=== Обучение нейронной сети ===" << std::endl;
-    const int epochs = 500;
-    const double learning_rate = 0.1;
     
+    auto start = std::chrono::steady_clock::now();
     for (int epoch = 0; epoch < epochs; ++epoch) {
         double total_loss = 0.0;
-        for (const auto& [digit, target] : dataset) {
-            total_loss += nn.train(digit, target, learning_rate);
+        if (packed) {
+            for (size_t first = 0; first < packed->size(); first += chunk) {
+                size_t count = std::min(chunk, packed->size() - first);
+                chunk_inputs.resize(inputs.rows(), count);
+                chunk_targets.resize(targets.rows(), count);
+                packed->expand(first, chunk_inputs, chunk_targets);
+                total_loss += train_pass(chunk_inputs, chunk_targets);
+            }
+        } else {
+            total_loss = train_pass(inputs, targets);
         }
         if (epoch % 20 == 0 || epoch == epochs - 1) {
-            std::cout << "Epoch " << epoch << ", Loss: " << total_loss / dataset.size() << std::endl;
+            std::cout << "Epoch " << epoch << ", Loss: " << total_loss / samples << std::endl;
         }
     }
+    if (batch_size > 0) {
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Время обучения (пакеты по " << batch_size;
+        if (threads > 0) {
+            std::cout << ", потоков: " << (hogwild_mode ? hogwild.threads() : trainer.threads());
+            std::cout << (hogwild_mode ? ", Hogwild" : "");
+        }
+        std::cout << "): " << ms << " мс, "
+                  << ms / epochs << " мс на эпоху" << std::endl;
+    }
     
+    // Тестируем через снимок весов: весь датасет одним пакетом, сеть не меняется
+    InferenceEngine<double> engine(nn);
+    InferenceEngine<double>::Scratch scratch;
+    Eigen::MatrixXd predictions;
+    engine.predict(inputs, predictions, scratch);
+
     std::cout << "\n=== Тестирование сети ===" << std::endl;
     for (size_t i = 0; i < dataset.size(); ++i) {
-        Eigen::VectorXd prediction = nn.predict(dataset[i].first);
+        Eigen::VectorXd prediction = predictions.col(i);
         int predicted_digit = 0;
         double max_prob = prediction(0);
         for (int j = 1; j < 10; ++j) {
@@ -369,6 +2399,16 @@ int main() {
         std::cout << "Предсказание: " << predicted_digit << " (вероятность: " << max_prob << ")" << std::endl;
         std::cout << "---" << std::endl;
     }
+
+    if (serve_threads > 0) {
+        report_serving(engine, dataset, serve_threads);
+    }
+
+    if (quantize) {
+        report_quantization(nn, engine, dataset);
+    }
+
+    AllocationScope::report(std::cerr);
     
     return 0;
 }
\ No newline at end of file
@@ -4,26 +4,44 @@
 #include <random>
 #include <vector>
 #include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <Eigen/Dense>
 
 // Структуры данных
+// Слой и сеть шаблонны по типу чисел (float или double), датасет хранится в double
+template <typename Scalar>
+using Vector = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+template <typename Scalar>
+using Matrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+
 struct ActivationFunction {
     bool supports_hadamard_derivative;
     int type;  // 0 = Sigmoid, 1 = ReLU, 2 = Softmax
 };
 
+template <typename Scalar>
 struct Layer {
-    Eigen::MatrixXd weights;
-    Eigen::VectorXd biases;
-    Eigen::VectorXd last_z;
-    Eigen::VectorXd last_input;
+    Matrix<Scalar> weights;
+    Vector<Scalar> biases;
+    Vector<Scalar> last_output;  // Выход активации: по нему считаются производные
+    Vector<Scalar> last_input;
     int input_size;
     int output_size;
     ActivationFunction* activation;
 };
 
+template <typename Scalar>
 struct NeuralNetwork {
-    std::vector<Layer*> layers;
+    std::vector<Layer<Scalar>*> layers;
     int loss_type;  // 0 = MSE
 };
 
@@ -32,48 +50,73 @@ struct Dataset {
     std::vector<Eigen::VectorXd> targets;
 };
 
+// Итог обучения одной сети для сравнения float и double
+struct PrecisionReport {
+    double final_loss;
+    int correct;
+    double train_ms;
+    Eigen::MatrixXd predictions;  // столбец на пример, приведён к double
+};
+
+// Упакованный файл цифр, отображённый в память: "STDIGIT1", число изображений (uint32),
+// ширина и высота (uint16), изображения по (ширина * высота + 7) / 8 байт (пиксели построчно,
+// младший бит первым), затем метки по байту
+struct PackedDigits {
+    int fd;
+    const uint8_t* data;
+    size_t length;
+    uint32_t count;
+    int width;
+    int height;
+    size_t image_bytes;
+    const uint8_t* images;
+    const uint8_t* labels;
+};
+
 // Процедуры для функций активации
-void sigmoid_activate(const Eigen::VectorXd& x, Eigen::VectorXd* result) {
-    *result = (1.0 + (-x).array().exp()).inverse();
+template <typename Scalar>
+void sigmoid_activate(const Vector<Scalar>& x, Vector<Scalar>* result) {
+    *result = (Scalar(1) + (-x).array().exp()).inverse();
 }
 
-void sigmoid_derivative(const Eigen::VectorXd& x, Eigen::VectorXd* result) {
-    Eigen::VectorXd s;
-    sigmoid_activate(x, &s);
-    *result = s.array() * (1.0 - s.array());
+// Производные принимают уже посчитанный выход активации s = f(z),
+// поэтому экспоненты прямого прохода не пересчитываются
+template <typename Scalar>
+void sigmoid_derivative(const Vector<Scalar>& s, Vector<Scalar>* result) {
+    *result = s.array() * (Scalar(1) - s.array());
 }
 
-void relu_activate(const Eigen::VectorXd& x, Eigen::VectorXd* result) {
-    *result = x.cwiseMax(0.0);
+template <typename Scalar>
+void relu_activate(const Vector<Scalar>& x, Vector<Scalar>* result) {
+    *result = x.cwiseMax(Scalar(0));
 }
 
-void relu_derivative(const Eigen::VectorXd& x, Eigen::VectorXd* result) {
-    Eigen::VectorXd activated;
-    relu_activate(x, &activated);
-    *result = (activated.array() > 0.0).cast<double>();
+template <typename Scalar>
+void relu_derivative(const Vector<Scalar>& activated, Vector<Scalar>* result) {
+    *result = (activated.array() > Scalar(0)).template cast<Scalar>();
 }
 
-void softmax_activate(const Eigen::VectorXd& x, Eigen::VectorXd* result) {
-    double max_val = x.maxCoeff();
-    Eigen::VectorXd exp_x = (x.array() - max_val).exp();
-    double sum = exp_x.sum();
+template <typename Scalar>
+void softmax_activate(const Vector<Scalar>& x, Vector<Scalar>* result) {
+    Scalar max_val = x.maxCoeff();
+    Vector<Scalar> exp_x = (x.array() - max_val).exp();
+    Scalar sum = exp_x.sum();
     *result = exp_x / sum;
 }
 
-void softmax_derivative(const Eigen::VectorXd& x, Eigen::VectorXd* result) {
-    Eigen::VectorXd s;
-    softmax_activate(x, &s);
-    *result = s.array() * (1.0 - s.array());
+template <typename Scalar>
+void softmax_derivative(const Vector<Scalar>& s, Vector<Scalar>* result) {
+    *result = s.array() * (Scalar(1) - s.array());
 }
 
-void softmax_jacobian(const Eigen::VectorXd& x, Eigen::MatrixXd* result) {
-    Eigen::VectorXd s;
-    softmax_activate(x, &s);
-    Eigen::MatrixXd diag_s = Eigen::MatrixXd(s.asDiagonal());
+template <typename Scalar>
+void softmax_jacobian(const Vector<Scalar>& s, Matrix<Scalar>* result) {
+    Matrix<Scalar> diag_s = Matrix<Scalar>(s.asDiagonal());
     *result = diag_s - s * s.transpose();
 }
 
-void activation_activate(ActivationFunction* act, const Eigen::VectorXd& x, Eigen::VectorXd* result) {
+template <typename Scalar>
+void activation_activate(ActivationFunction* act, const Vector<Scalar>& x, Vector<Scalar>* result) {
     if (act->type == 0) {
         sigmoid_activate(x, result);
     } else if (act->type == 1) {
@@ -83,70 +126,78 @@ void activation_activate(ActivationFunction* act, const Eigen::VectorXd& x, Eige
     }
 }
 
-void activation_derivative(ActivationFunction* act, const Eigen::VectorXd& x, Eigen::VectorXd* result) {
+template <typename Scalar>
+void activation_derivative(ActivationFunction* act, const Vector<Scalar>& output, Vector<Scalar>* result) {
     if (act->type == 0) {
-        sigmoid_derivative(x, result);
+        sigmoid_derivative(output, result);
     } else if (act->type == 1) {
-        relu_derivative(x, result);
+        relu_derivative(output, result);
     } else if (act->type == 2) {
-        softmax_derivative(x, result);
+        softmax_derivative(output, result);
     }
 }
 
-void activation_jacobian(ActivationFunction* act, const Eigen::VectorXd& x, Eigen::MatrixXd* result) {
+template <typename Scalar>
+void activation_jacobian(ActivationFunction* act, const Vector<Scalar>& output, Matrix<Scalar>* result) {
     if (act->type == 2) {
-        softmax_jacobian(x, result);
+        softmax_jacobian(output, result);
     } else {
-        Eigen::VectorXd diag;
-        activation_derivative(act, x, &diag);
+        Vector<Scalar> diag;
+        activation_derivative(act, output, &diag);
         *result = diag.asDiagonal();
     }
 }
 
 // Процедуры для функции потерь
-void mse_loss(const Eigen::VectorXd& predicted, const Eigen::VectorXd& target, double* loss_val) {
-    Eigen::VectorXd diff = predicted - target;
-    *loss_val = diff.squaredNorm() / predicted.size();
+template <typename Scalar>
+void mse_loss(const Vector<Scalar>& predicted, const Vector<Scalar>& target, Scalar* loss_val) {
+    Vector<Scalar> diff = predicted - target;
+    *loss_val = diff.squaredNorm() / Scalar(predicted.size());
 }
 
-void mse_derivative(const Eigen::VectorXd& predicted, const Eigen::VectorXd& target, Eigen::VectorXd* gradient) {
-    *gradient = 2.0 * (predicted - target) / predicted.size();
+template <typename Scalar>
+void mse_derivative(const Vector<Scalar>& predicted, const Vector<Scalar>& target, Vector<Scalar>* gradient) {
+    *gradient = Scalar(2) * (predicted - target) / Scalar(predicted.size());
 }
 
 // Процедуры для слоя
-void layer_init(Layer* layer, int input_size, int output_size, ActivationFunction* activation) {
+template <typename Scalar>
+void layer_init(Layer<Scalar>* layer, int input_size, int output_size, ActivationFunction* activation) {
     layer->input_size = input_size;
     layer->output_size = output_size;
     layer->activation = activation;
-    layer->weights = Eigen::MatrixXd(output_size, input_size);
-    layer->biases = Eigen::VectorXd(output_size);
+    layer->weights = Matrix<Scalar>(output_size, input_size);
+    layer->biases = Vector<Scalar>(output_size);
     
     // Xavier initialization
     double limit = std::sqrt(6.0 / (input_size + output_size));
-    layer->weights = Eigen::MatrixXd::Random(output_size, input_size) * limit;
+    layer->weights = (Eigen::MatrixXd::Random(output_size, input_size) * limit).cast<Scalar>();
     layer->biases.setZero();
 }
 
-void layer_forward(Layer* layer, const Eigen::VectorXd& input, Eigen::VectorXd* output) {
+template <typename Scalar>
+void layer_forward(Layer<Scalar>* layer, const Vector<Scalar>& input, Vector<Scalar>* output) {
     layer->last_input = input;
-    layer->last_z = layer->weights * input + layer->biases;
-    activation_activate(layer->activation, layer->last_z, output);
+    Vector<Scalar> z = layer->weights * input + layer->biases;
+    activation_activate(layer->activation, z, &layer->last_output);
+    *output = layer->last_output;
 }
 
-void layer_backward(Layer* layer, const Eigen::VectorXd& gradient, double learning_rate, Eigen::VectorXd* prev_gradient) {
-    Eigen::VectorXd delta;
+template <typename Scalar>
+void layer_backward(Layer<Scalar>* layer, const Vector<Scalar>& gradient, Scalar learning_rate, Vector<Scalar>* prev_gradient) {
+    Vector<Scalar> delta;
     
     if (layer->activation->supports_hadamard_derivative) {
-        Eigen::VectorXd activation_grad;
-        activation_derivative(layer->activation, layer->last_z, &activation_grad);
+        Vector<Scalar> activation_grad;
+        activation_derivative(layer->activation, layer->last_output, &activation_grad);
         delta = gradient.array() * activation_grad.array();
     } else {
-        Eigen::MatrixXd J;
-        activation_jacobian(layer->activation, layer->last_z, &J);
+        Matrix<Scalar> J;
+        activation_jacobian(layer->activation, layer->last_output, &J);
         delta = J * gradient;
     }
     
-    Eigen::MatrixXd old_weights = layer->weights;
+    Matrix<Scalar> old_weights = layer->weights;
     
     layer->weights -= learning_rate * delta * layer->last_input.transpose();
     layer->biases -= learning_rate * delta;
@@ -155,46 +206,51 @@ void layer_backward(Layer* layer, const Eigen::VectorXd& gradient, double learni
 }
 
 // Процедуры для нейронной сети
-void network_init(NeuralNetwork* nn, int loss_type) {
+template <typename Scalar>
+void network_init(NeuralNetwork<Scalar>* nn, int loss_type) {
     nn->loss_type = loss_type;
     nn->layers.clear();
 }
 
-void network_add_layer(NeuralNetwork* nn, Layer* layer) {
+template <typename Scalar>
+void network_add_layer(NeuralNetwork<Scalar>* nn, Layer<Scalar>* layer) {
     nn->layers.push_back(layer);
 }
 
-void network_forward(NeuralNetwork* nn, const Eigen::VectorXd& input, Eigen::VectorXd* output) {
-    Eigen::VectorXd x = input;
+template <typename Scalar>
+void network_forward(NeuralNetwork<Scalar>* nn, const Vector<Scalar>& input, Vector<Scalar>* output) {
+    Vector<Scalar> x = input;
     for (size_t i = 0; i < nn->layers.size(); ++i) {
-        Eigen::VectorXd temp;
+        Vector<Scalar> temp;
         layer_forward(nn->layers[i], x, &temp);
         x = temp;
     }
     *output = x;
 }
 
-void network_train(NeuralNetwork* nn, const Eigen::VectorXd& input, const Eigen::VectorXd& target, double learning_rate, double* loss_val) {
-    Eigen::VectorXd output;
+template <typename Scalar>
+void network_train(NeuralNetwork<Scalar>* nn, const Vector<Scalar>& input, const Vector<Scalar>& target, Scalar learning_rate, Scalar* loss_val) {
+    Vector<Scalar> output;
     network_forward(nn, input, &output);
     
     if (nn->loss_type == 0) {
         mse_loss(output, target, loss_val);
     }
     
-    Eigen::VectorXd gradient;
+    Vector<Scalar> gradient;
     if (nn->loss_type == 0) {
         mse_derivative(output, target, &gradient);
     }
     
     for (int i = nn->layers.size() - 1; i >= 0; --i) {
-        Eigen::VectorXd prev_grad;
+        Vector<Scalar> prev_grad;
         layer_backward(nn->layers[i], gradient, learning_rate, &prev_grad);
         gradient = prev_grad;
     }
 }
 
-void network_predict(NeuralNetwork* nn, const Eigen::VectorXd& input, Eigen::VectorXd* output) {
+template <typename Scalar>
+void network_predict(NeuralNetwork<Scalar>* nn, const Vector<Scalar>& input, Vector<Scalar>* output) {
     network_forward(nn, input, output);
 }
 
@@ -318,12 +374,224 @@ void create_dataset(Dataset* dataset) {
     dataset->targets.push_back(target9);
 }
 
-int main() {
+// Обучаем сеть 400-128-10 на типе Scalar и оцениваем её на датасете
+template <typename Scalar>
+void train_and_evaluate(const Dataset* dataset, ActivationFunction* hidden_act, int epochs, double learning_rate, PrecisionReport* report) {
+    ActivationFunction softmax_act;
+    softmax_act.type = 2;
+    softmax_act.supports_hadamard_derivative = false;
+
+    std::srand(1);  // одинаковые начальные веса для float и double
+    NeuralNetwork<Scalar> nn;
+    network_init(&nn, 0);  // MSE loss
+
+    Layer<Scalar> layer1;
+    layer_init(&layer1, 400, 128, hidden_act);
+    network_add_layer(&nn, &layer1);
+
+    Layer<Scalar> layer2;
+    layer_init(&layer2, 128, 10, &softmax_act);
+    network_add_layer(&nn, &layer2);
+
+    std::vector<Vector<Scalar>> digits;
+    std::vector<Vector<Scalar>> targets;
+    for (size_t i = 0; i < dataset->digits.size(); ++i) {
+        digits.push_back(dataset->digits[i].cast<Scalar>());
+        targets.push_back(dataset->targets[i].cast<Scalar>());
+    }
+
+    report->final_loss = 0.0;
+    report->correct = 0;
+    report->predictions = Eigen::MatrixXd(10, digits.size());
+    auto start = std::chrono::steady_clock::now();
+    for (int epoch = 0; epoch < epochs; ++epoch) {
+        Scalar total_loss = 0;
+        for (size_t i = 0; i < digits.size(); ++i) {
+            Scalar loss_val;
+            network_train(&nn, digits[i], targets[i], Scalar(learning_rate), &loss_val);
+            total_loss += loss_val;
+        }
+        report->final_loss = static_cast<double>(total_loss) / digits.size();
+    }
+    report->train_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t i = 0; i < digits.size(); ++i) {
+        Vector<Scalar> prediction;
+        network_predict(&nn, digits[i], &prediction);
+        Eigen::Index predicted_digit;
+        Eigen::Index expected_digit;
+        prediction.maxCoeff(&predicted_digit);
+        dataset->targets[i].maxCoeff(&expected_digit);
+        report->correct += predicted_digit == expected_digit;
+        report->predictions.col(i) = prediction.template cast<double>();
+    }
+}
+
+// Процедуры для упакованного файла цифр
+bool packed_save(const Dataset* dataset, int width, int height, const std::string& path) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+    uint32_t count = static_cast<uint32_t>(dataset->digits.size());
+    uint16_t size[] = {static_cast<uint16_t>(width), static_cast<uint16_t>(height)};
+    out.write("STDIGIT1", 8);
+    out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    out.write(reinterpret_cast<const char*>(size), sizeof(size));
+
+    std::vector<uint8_t> packed((static_cast<size_t>(width) * height + 7) / 8);
+    for (size_t i = 0; i < dataset->digits.size(); ++i) {
+        std::fill(packed.begin(), packed.end(), 0);
+        for (Eigen::Index p = 0; p < dataset->digits[i].size(); ++p) {
+            if (dataset->digits[i](p) > 0.5) {
+                packed[p / 8] |= static_cast<uint8_t>(1u << (p % 8));
+            }
+        }
+        out.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+    }
+    for (size_t i = 0; i < dataset->targets.size(); ++i) {
+        Eigen::Index label;
+        dataset->targets[i].maxCoeff(&label);
+        out.put(static_cast<char>(label));
+    }
+    return static_cast<bool>(out);
+}
+
+void packed_close(PackedDigits* file) {
+    if (file->data) {
+        ::munmap(const_cast<uint8_t*>(file->data), file->length);
+        file->data = nullptr;
+    }
+    if (file->fd >= 0) {
+        ::close(file->fd);
+        file->fd = -1;
+    }
+}
+
+bool packed_open(PackedDigits* file, const std::string& path) {
+    const size_t header_size = 8 + sizeof(uint32_t) + 2 * sizeof(uint16_t);
+    file->data = nullptr;
+    file->fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (file->fd < 0 || ::fstat(file->fd, &info) != 0 || info.st_size < static_cast<off_t>(header_size)) {
+        packed_close(file);
+        return false;
+    }
+    file->length = static_cast<size_t>(info.st_size);
+    void* mapped = ::mmap(nullptr, file->length, PROT_READ, MAP_PRIVATE, file->fd, 0);
+    if (mapped == MAP_FAILED) {
+        packed_close(file);
+        return false;
+    }
+    file->data = static_cast<const uint8_t*>(mapped);
+    ::madvise(mapped, file->length, MADV_SEQUENTIAL);
+
+    uint16_t size[2];
+    std::memcpy(&file->count, file->data + 8, sizeof(file->count));
+    std::memcpy(size, file->data + 12, sizeof(size));
+    file->width = size[0];
+    file->height = size[1];
+    file->image_bytes = (static_cast<size_t>(file->width) * file->height + 7) / 8;
+    file->images = file->data + header_size;
+    file->labels = file->images + static_cast<size_t>(file->count) * file->image_bytes;
+    if (std::memcmp(file->data, "STDIGIT1", 8) != 0
+        || static_cast<size_t>(file->labels + file->count - file->data) != file->length) {
+        packed_close(file);
+        return false;
+    }
+    // Метка - цифра 0..9, иначе файл повреждён
+    for (uint32_t i = 0; i < file->count; ++i) {
+        if (file->labels[i] > 9) {
+            packed_close(file);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Разворачиваем изображения [first, first + count) в столбцы inputs, метки - в one-hot targets
+void packed_expand(const PackedDigits* file, size_t first, size_t count, Eigen::MatrixXd* inputs, Eigen::MatrixXd* targets) {
+    const int pixels = file->width * file->height;
+    inputs->resize(pixels, count);
+    targets->resize(10, count);
+    targets->setZero();
+    for (size_t j = 0; j < count; ++j) {
+        const uint8_t* image = file->images + (first + j) * file->image_bytes;
+        for (int p = 0; p < pixels; ++p) {
+            (*inputs)(p, j) = (image[p >> 3] >> (p & 7)) & 1;
+        }
+        (*targets)(file->labels[first + j], j) = 1.0;
+    }
+}
+
+int main(int argc, char* argv[]) {
     Dataset dataset;
     create_dataset(&dataset);
-    
+
+    // --write-dataset FILE: записать цифры в упакованный файл; --dataset FILE: обучать по нему
+    // --compare-precision: обучить сеть на float и на double и сравнить точность и скорость
+    std::string write_path;
+    std::string dataset_path;
+    bool compare_precision = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--write-dataset" && i + 1 < argc) {
+            write_path = argv[++i];
+        } else if (arg == "--dataset" && i + 1 < argc) {
+            dataset_path = argv[++i];
+        } else if (arg == "--compare-precision") {
+            compare_precision = true;
+        } else {
+            std::cerr << "Неизвестный аргумент: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    if (compare_precision) {
+        ActivationFunction relu_act;
+        relu_act.type = 1;
+        relu_act.supports_hadamard_derivative = true;
+
+        const int epochs = 500;
+        PrecisionReport as_double;
+        PrecisionReport as_float;
+        train_and_evaluate<double>(&dataset, &relu_act, epochs, 0.1, &as_double);
+        train_and_evaluate<float>(&dataset, &relu_act, epochs, 0.1, &as_float);
+        std::cout << "=== float и double (" << epochs << " эпох) ===" << std::endl;
+        std::cout << "double: верно " << as_double.correct << "/" << dataset.digits.size()
+                  << ", потери " << as_double.final_loss
+                  << ", обучение " << as_double.train_ms << " мс" << std::endl;
+        std::cout << "float: верно " << as_float.correct << "/" << dataset.digits.size()
+                  << ", потери " << as_float.final_loss
+                  << ", обучение " << as_float.train_ms << " мс" << std::endl;
+        std::cout << "Наибольшее расхождение вероятностей: "
+                  << (as_double.predictions - as_float.predictions).cwiseAbs().maxCoeff()
+                  << ", ускорение float: " << as_double.train_ms / as_float.train_ms << "x" << std::endl;
+        return 0;
+    }
+
+    if (!write_path.empty()) {
+        if (!packed_save(&dataset, 20, 20, write_path)) {
+            std::cerr << "Ошибка записи файла цифр: " << write_path << std::endl;
+            return 1;
+        }
+        std::cout << "Записано изображений: " << dataset.digits.size() << " в " << write_path << std::endl;
+        return 0;
+    }
+
+    PackedDigits packed;
+    packed.fd = -1;
+    packed.data = nullptr;
+    if (!dataset_path.empty()) {
+        if (!packed_open(&packed, dataset_path) || packed.width * packed.height != 400) {
+            std::cerr << "Не удалось открыть файл цифр: " << dataset_path << std::endl;
+            packed_close(&packed);
+            return 1;
+        }
+        std::cout << "Файл цифр: " << packed.count << " изображений, " << packed.length << " байт" << std::endl;
+    }
     // Создаём нейронную сеть
-    NeuralNetwork nn;
+    NeuralNetwork<double> nn;
     network_init(&nn, 0);  // MSE loss
     
     ActivationFunction relu_act;
@@ -334,11 +602,11 @@ int main() {
     softmax_act.type = 2;
     softmax_act.supports_hadamard_derivative = false;
     
-    Layer layer1;
+    Layer<double> layer1;
     layer_init(&layer1, 400, 128, &relu_act);
     network_add_layer(&nn, &layer1);
     
-    Layer layer2;
+    Layer<double> layer2;
     layer_init(&layer2, 128, 10, &softmax_act);
     network_add_layer(&nn, &layer2);
     
@@ -346,17 +614,36 @@ int main() {
     const int epochs = 500;
     const double learning_rate = 0.1;
     
+    // Файл разворачивается кусками в одни и те же буферы
+    const size_t chunk = 4096;
+    Eigen::MatrixXd chunk_inputs;
+    Eigen::MatrixXd chunk_targets;
+    const size_t samples = packed.data ? packed.count : dataset.digits.size();
+    
     for (int epoch = 0; epoch < epochs; ++epoch) {
         double total_loss = 0.0;
-        for (size_t i = 0; i < dataset.digits.size(); ++i) {
-            double loss_val;
-            network_train(&nn, dataset.digits[i], dataset.targets[i], learning_rate, &loss_val);
-            total_loss += loss_val;
+        if (packed.data) {
+            for (size_t first = 0; first < packed.count; first += chunk) {
+                size_t count = std::min(chunk, packed.count - first);
+                packed_expand(&packed, first, count, &chunk_inputs, &chunk_targets);
+                for (size_t i = 0; i < count; ++i) {
+                    double loss_val;
+                    network_train(&nn, Eigen::VectorXd(chunk_inputs.col(i)), Eigen::VectorXd(chunk_targets.col(i)), learning_rate, &loss_val);
+                    total_loss += loss_val;
+                }
+            }
+        } else {
+            for (size_t i = 0; i < dataset.digits.size(); ++i) {
+                double loss_val;
+                network_train(&nn, dataset.digits[i], dataset.targets[i], learning_rate, &loss_val);
+                total_loss += loss_val;
+            }
         }
         if (epoch % 20 == 0 || epoch == epochs - 1) {
-            std::cout << "Epoch " << epoch << ", Loss: " << total_loss / dataset.digits.size() << std::endl;
+            std::cout << "Epoch " << epoch << ", Loss: " << total_loss / samples << std::endl;
         }
     }
+    packed_close(&packed);
     
     std::cout << "\n=== Тестирование сети ===" << std::endl;
     for (size_t i = 0; i < dataset.digits.size(); ++i) {